@@ -0,0 +1,33 @@
+#!/bin/sh
+# actor throughput: messages per second with 1 to 8 actors
+#  usage: bench/actor.sh BINARY [MESSAGES]
+#  NB: the repl thread tells every actor MESSAGES numbers in turn, then
+#      asks each of them once, which returns once all its messages
+#      were handled (mailboxes are in order). Actors are pinned to
+#      cores, so they only run in parallel on machines that have them.
+if [ $# -lt 1 ]; then
+    echo "usage: $0 BINARY [MESSAGES]" >&2
+    exit 2
+fi
+n=${2:-100000}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+for actors in 1 2 4 8; do
+    awk -v actors="$actors" -v n="$n" 'BEGIN {
+        names = "abcdefgh"
+        for (j = 1; j <= actors; ++j)
+            printf "(def {%s} (actor {+ 1}))\n", substr(names, j, 1)
+        printf "(dotimes {i} %d {", n
+        for (j = 1; j <= actors; ++j)
+            printf "%s(tell %s i)", (j > 1 ? " " : "(list "), substr(names, j, 1)
+        print ")})"
+        for (j = 1; j <= actors; ++j)
+            printf "(ask %s 0)\n", substr(names, j, 1)
+    }' > "$tmp/actor.alba"
+    start=$(date +%s%N)
+    "$1" "$tmp/actor.alba" > /dev/null
+    end=$(date +%s%N)
+    ms=$(( (end - start) / 1000000 ))
+    echo "$actors actors: $ms ms, $(( n * actors * 1000 / (ms > 0 ? ms : 1) )) messages/s"
+done
@@ -0,0 +1,38 @@
+#!/bin/sh
+# arithmetic kernels over calls of 10^6 arguments
+#  usage: bench/arith.sh BINARY [ARGUMENTS] [CALLS]
+#  NB: reading the arguments takes far longer than the kernels, so
+#      the call is read once into a q-expression (with a global operand
+#      keeping it from being folded) and run by dotimes; the same
+#      script run 0 times gives the time to subtract. The time per
+#      call includes copying the arguments out of the compiled form.
+if [ $# -lt 1 ]; then
+    echo "usage: $0 BINARY [ARGUMENTS] [CALLS]" >&2
+    exit 2
+fi
+n=${2:-1000000}
+calls=${3:-100}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# microseconds taken by script running call of op count times
+run() {
+    awk -v op="$1" -v n="$n" -v count="$2" 'BEGIN {
+        print "(def {x} 1)"
+        printf "(def {call} {%s x", op
+        for (i = 0; i < n; ++i) printf " %d", i % 2 ? 1 : -1
+        print "})"
+        print "(dotimes {i} " count " call)"
+    }' > "$tmp/arith.alba"
+    start=$(date +%s%N)
+    "$BIN" "$tmp/arith.alba" > /dev/null
+    end=$(date +%s%N)
+    echo $(( (end - start) / 1000 ))
+}
+
+BIN=$1
+for op in + - '*' /; do
+    us=$(( $(run "$op" "$calls") - $(run "$op" 0) ))
+    echo "($op x$n): $(( us / calls )) us per call"
+done
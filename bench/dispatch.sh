@@ -0,0 +1,47 @@
+#!/bin/sh
+# VM dispatch: direct threading against the portable switch
+#  usage: bench/dispatch.sh THREADED_BINARY SWITCH_BINARY [LINES]
+#  NB: the switch binary is built with -DALBA_VM_SWITCH. Both run the
+#      same script of superinstruction shapes ((+ sym num), (head sym))
+#      and generic calls on the VM. Instructions per second and the
+#      branch miss rate are reported when perf is available, the
+#      wall clock time otherwise.
+if [ $# -lt 2 ]; then
+    echo "usage: $0 THREADED_BINARY SWITCH_BINARY [LINES]" >&2
+    exit 2
+fi
+lines=${3:-200000}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+awk -v n="$lines" 'BEGIN {
+    print "(def {x} 1)"
+    print "(def {l} {1 2 3})"
+    for (i = 0; i < n; i += 3) {
+        print "(+ x 1)"
+        print "(head l)"
+        print "(+ (* x 2) (- x 1) (head (tail l)))"
+    }
+}' > "$tmp/dispatch.alba"
+
+for bin in "$1" "$2"; do
+    echo "== $bin"
+    if command -v perf > /dev/null; then
+        perf stat -x, -e instructions,branches,branch-misses,task-clock \
+            "$bin" --vm "$tmp/dispatch.alba" 2> "$tmp/stat" > /dev/null
+        awk -F, '
+            $3 == "instructions"  { ins = $1 }
+            $3 == "branches"      { br = $1 }
+            $3 == "branch-misses" { miss = $1 }
+            $3 == "task-clock"    { ms = $1 }
+            END {
+                printf "%.0f instructions/s\n", ins / (ms / 1000)
+                printf "%.2f%% branch misses\n", 100 * miss / br
+            }' "$tmp/stat"
+    else
+        start=$(date +%s%N)
+        "$bin" --vm "$tmp/dispatch.alba" > /dev/null
+        end=$(date +%s%N)
+        echo "$(( (end - start) / 1000000 )) ms (no perf: no counters)"
+    fi
+done
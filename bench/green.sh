@@ -0,0 +1,57 @@
+#!/bin/sh
+# green threads: cost of a spawn and of a switch between threads
+#  usage: bench/green.sh BINARY [THREADS] [SWITCHES]
+#  NB: spawns THREADS threads evaluating a constant then joins them all,
+#      and has two threads yield to each other SWITCHES times in all
+#      (looping through tail calls, as loop bodies cannot suspend).
+#      Each time is taken against the same script with the thread
+#      builtins swapped for plain calls (spawn and join for eval and +,
+#      yield for list), which leaves startup and loop costs out.
+if [ $# -lt 1 ]; then
+    echo "usage: $0 BINARY [THREADS] [SWITCHES]" >&2
+    exit 2
+fi
+threads=${2:-100000}
+switches=${3:-200000}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# nanoseconds taken by script on stdin
+run() {
+    cat > "$tmp/g.alba"
+    start=$(date +%s%N)
+    "$bin" "$tmp/g.alba" > /dev/null
+    end=$(date +%s%N)
+    echo $((end - start))
+}
+
+# nanoseconds per operation of script on stdin (N replaced by n), against
+# its copy edited by sed script base
+report() {
+    name=$1 n=$2 base=$3
+    sed "s/N/$n/g" > "$tmp/script"
+    ns=$(run < "$tmp/script")
+    basens=$(sed "$base" "$tmp/script" | run)
+    awk -v name="$name" -v n="$n" -v ns="$ns" -v base="$basens" 'BEGIN {
+        printf "%s: %.0f ns each (%d in %d ms, %d ms without threads)\n",
+               name, (ns - base) / n, n, ns / 1000000, base / 1000000
+    }'
+}
+
+bin=$1
+report spawn "$threads" 's/spawn/eval/; s/join/+/' <<'END'
+(dotimes {i} N {spawn {+ 1 2}})
+(dotimes {i} N {join i})
+END
+report switch "$switches" 's/yield/list/; s/spawn/eval/; s/(join [01])//' <<'END'
+(def {a} (/ N 2))
+(def {b} (/ N 2))
+(def {stop} (from-list {0 {0}}))
+(def {la} {eval (get stop a {eval (head (list la (yield (def {a} (- a 1)))))})})
+(def {lb} {eval (get stop b {eval (head (list lb (yield (def {b} (- b 1)))))})})
+(spawn {eval la})
+(spawn {eval lb})
+(join 0)
+(join 1)
+END
@@ -0,0 +1,46 @@
+#!/bin/sh
+# startup with a prelude: running its script against loading its image
+#  usage: bench/image.sh BINARY [DEFS]
+#  NB: the prelude binds DEFS generated names (3000 by default), each to
+#      a value computed when it runs. Its image is written by save-image
+#      beforehand. The time reported is that of a new interpreter from
+#      startup to the end of its first eval, which reads the last name
+#      bound by the prelude; both ways must print the same result.
+if [ $# -lt 1 ]; then
+    echo "usage: $0 BINARY [DEFS]" >&2
+    exit 2
+fi
+defs=${2:-3000}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+# names are made of letters only (symbols hold no digits)
+awk -v n="$defs" -v dir="$tmp" 'BEGIN {
+    for (j = 0; j < n; ++j) {
+        name = "p"
+        for (k = j; k > 0; k = int(k / 26))
+            name = name substr("abcdefghijklmnopqrstuvwxyz", k % 26 + 1, 1)
+        printf "(def {%s} (fold {a x} %d (range 20) {+ a x}))\n", name, j \
+            > dir "/prelude.alba"
+    }
+    print name > dir "/first.alba"
+}'
+echo "(save-image \"$tmp/prelude.img\")" > "$tmp/save.alba"
+"$1" "$tmp/prelude.alba" "$tmp/save.alba" > /dev/null
+
+for run in script image; do
+    if [ "$run" = script ]; then
+        set -- "$1" "$tmp/prelude.alba" "$tmp/first.alba"
+    else
+        set -- "$1" --image "$tmp/prelude.img" "$tmp/first.alba"
+    fi
+    "$@" > /dev/null # warm the page cache
+    start=$(date +%s%N)
+    "$@" | tail -n 1 > "$tmp/$run.out"
+    end=$(date +%s%N)
+    echo "$run: $(( (end - start) / 1000000 )) ms to first eval ($defs defs)"
+done
+if ! cmp -s "$tmp/script.out" "$tmp/image.out"; then
+    echo "image does not match the prelude" >&2
+    exit 1
+fi
@@ -0,0 +1,32 @@
+#!/bin/sh
+# event loop: concurrent reads and writes over local socket pairs
+#  usage: bench/io.sh BINARY [PAIRS]
+#  NB: one task per pair waits to read from it, then one task per pair
+#      writes to its other end, so that all the readers are suspended
+#      on the event loop at once (10000 pairs by default). Every pair
+#      takes two descriptors: the limit of open files is raised first.
+if [ $# -lt 1 ]; then
+    echo "usage: $0 BINARY [PAIRS]" >&2
+    exit 2
+fi
+n=${2:-10000}
+if ! ulimit -n $((2 * n + 64)) 2>/dev/null; then
+    echo "cannot raise the limit of open files to $((2 * n + 64))" >&2
+    exit 1
+fi
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+cat > "$tmp/io.alba" <<END
+(def {ps} (io-pairs $n))
+(fold {n p} 0 ps {+ n (async (list io-read (head p) 5))})
+(fold {n p} 0 ps {+ n (async (list io-write (head (tail p)) "hello"))})
+(fold {n i} 0 (range $n) {+ n (str-len (await i))})
+(fold {n i} 0 (range $n) {+ n (await (+ i $n))})
+END
+
+start=$(date +%s%N)
+"$1" "$tmp/io.alba" > "$tmp/io.out"
+end=$(date +%s%N)
+tail -2 "$tmp/io.out" | tr '\n' ' '
+echo "bytes read and written by $n pairs in $(( (end - start) / 1000000 )) ms"
@@ -0,0 +1,27 @@
+#!/bin/sh
+# arithmetic throughput: JIT against the closure interpreter
+#  usage: bench/jit.sh JIT_BINARY NO_JIT_BINARY [ITERATIONS]
+#  NB: the second binary is built with -DALBA_NO_JIT. Both run a loop
+#      over an arithmetic tree of globals, which tiers up to native
+#      code after JIT_THRESHOLD runs on the first one.
+if [ $# -lt 2 ]; then
+    echo "usage: $0 JIT_BINARY NO_JIT_BINARY [ITERATIONS]" >&2
+    exit 2
+fi
+n=${3:-10000000}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+cat > "$tmp/jit.alba" <<END
+(def {x} 7)
+(def {y} 5)
+(dotimes {i} $n {+ (* x 3) (- y 2) (/ (* x y) 2) (- (+ x y) (* y y))})
+END
+
+for bin in "$1" "$2"; do
+    start=$(date +%s%N)
+    "$bin" "$tmp/jit.alba" > /dev/null
+    end=$(date +%s%N)
+    ms=$(( (end - start) / 1000000 ))
+    echo "$bin: $ms ms, $(( n * 1000 / (ms > 0 ? ms : 1) )) forms/s"
+done
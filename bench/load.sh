@@ -0,0 +1,32 @@
+#!/bin/sh
+# startup loading of many scripts: io_uring against the pread fallback
+#  usage: bench/load.sh URING_BINARY PREAD_BINARY [FILES] [LINES]
+#  NB: the pread binary is built with -DALBA_NO_URING. Both run a
+#      directory of FILES generated scripts (1000 by default) of LINES
+#      lines each, passed at once on the command line, so that they are
+#      all read up front (see files_read_all) before any is run.
+if [ $# -lt 2 ]; then
+    echo "usage: $0 URING_BINARY PREAD_BINARY [FILES] [LINES]" >&2
+    exit 2
+fi
+files=${3:-1000}
+lines=${4:-10}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+awk -v files="$files" -v lines="$lines" -v dir="$tmp" 'BEGIN {
+    for (f = 0; f < files; ++f) {
+        path = sprintf("%s/s%04d.alba", dir, f)
+        for (j = 0; j < lines; ++j)
+            printf "(def {x} (+ %d (* %d 3)))\n", f, j > path
+        close(path)
+    }
+}'
+
+for bin in "$1" "$2"; do
+    "$bin" "$tmp"/*.alba > /dev/null # warm the page cache
+    start=$(date +%s%N)
+    "$bin" "$tmp"/*.alba > /dev/null
+    end=$(date +%s%N)
+    echo "$bin: $(( (end - start) / 1000000 )) ms for $files files"
+done
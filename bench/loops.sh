@@ -0,0 +1,50 @@
+#!/bin/sh
+# native loops against the recursive eval loop they replace
+#  usage: bench/loops.sh BINARY [ITERATIONS]
+#  NB: while counts a global down, dotimes adds to its counter and fold
+#      sums a range; the recursive loop counts down through tail calls
+#      of eval (as in tests/tailcall.alba). Every script is also run
+#      for 0 iterations, whose time is taken off.
+if [ $# -lt 1 ]; then
+    echo "usage: $0 BINARY [ITERATIONS]" >&2
+    exit 2
+fi
+n=${2:-1000000}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# nanoseconds taken by script $1 with N replaced by $2
+run() {
+    sed "s/N/$2/g" "$tmp/$1.src" > "$tmp/$1.alba"
+    start=$(date +%s%N)
+    "$bin" "$tmp/$1.alba" > /dev/null
+    end=$(date +%s%N)
+    echo $((end - start))
+}
+
+cat > "$tmp/while.src" <<'END'
+(def {n} N)
+(while {n} {def {n} (- n 1)})
+END
+cat > "$tmp/dotimes.src" <<'END'
+(dotimes {i} N {+ i 1})
+END
+cat > "$tmp/fold.src" <<'END'
+(fold {a x} 0 (range N) {+ a x})
+END
+cat > "$tmp/eval.src" <<'END'
+(def {n} N)
+(def {stop} (from-list {0 {n}}))
+(def {loop} {eval (get stop n {eval (head (list loop (def {n} (- n 1))))})})
+(eval loop)
+END
+
+bin=$1
+for loop in while dotimes fold eval; do
+    ns=$(run $loop "$n")
+    base=$(run $loop 0)
+    awk -v loop="$loop" -v n="$n" -v ns="$ns" -v base="$base" 'BEGIN {
+        printf "%-8s %6.1f ns per iteration\n", loop, (ns - base) / n
+    }'
+done
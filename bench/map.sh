@@ -0,0 +1,42 @@
+#!/bin/sh
+# lookups in maps against association lists of q-expressions
+#  usage: bench/map.sh BINARY [ENTRIES] [LOOKUPS]
+#  NB: both hold ENTRIES keys 0..ENTRIES-1. Maps are looked up with
+#      get; association lists of {key value} pairs are folded over,
+#      keeping the value whose key matches (the language has no
+#      comparisons, so the match is computed arithmetically), which
+#      costs a full scan like a lookup of the last key would.
+if [ $# -lt 1 ]; then
+    echo "usage: $0 BINARY [ENTRIES] [LOOKUPS]" >&2
+    exit 2
+fi
+n=${2:-1000}
+lookups=${3:-2000}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+awk -v n="$n" 'BEGIN {
+    printf "(def {alist} {"
+    for (k = 0; k < n; ++k) printf "%s{%d %d}", (k ? " " : ""), k, 3 * k
+    printf "})\n"
+}' > "$tmp/alist.alba"
+awk -v n="$n" 'BEGIN {
+    printf "(def {m} (from-list {"
+    for (k = 0; k < n; ++k) printf "%s%d %d", (k ? " " : ""), k, 3 * k
+    printf "}))\n"
+}' > "$tmp/map.alba"
+cat >> "$tmp/alist.alba" <<END
+(def {n} $n)
+(dotimes {i} $lookups {fold {a p} 0 alist {+ a (* (head (tail p)) (- 1 (/ (+ (* (- (head p) (- i (* (/ i n) n))) (- (head p) (- i (* (/ i n) n)))) (- (* n n) 1)) (* n n))))}})
+END
+cat >> "$tmp/map.alba" <<END
+(def {n} $n)
+(dotimes {i} $lookups {get m (- i (* (/ i n) n))})
+END
+
+for kind in alist map; do
+    start=$(date +%s%N)
+    "$1" "$tmp/$kind.alba" > /dev/null
+    end=$(date +%s%N)
+    echo "$kind: $(( (end - start) / 1000000 )) ms for $lookups lookups in $n entries"
+done
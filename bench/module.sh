@@ -0,0 +1,40 @@
+#!/bin/sh
+# load of a large codebase: parsing against the .albac cache
+#  usage: bench/module.sh BINARY [LINES]
+#  NB: a file of LINES generated lines (50000 by default) is loaded
+#      twice by (load "file"), each time from a new interpreter. The
+#      first load parses the file and writes its cache, the second
+#      rebuilds the forms from the cache. Both run the forms, and
+#      must print the same result.
+if [ $# -lt 1 ]; then
+    echo "usage: $0 BINARY [LINES]" >&2
+    exit 2
+fi
+lines=${2:-50000}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+awk -v n="$lines" 'BEGIN {
+    for (j = 0; j < n; ++j) {
+        if (j % 3 == 0)
+            printf "(def {x} (+ %d (* %d 3)))\n", j, j
+        else if (j % 3 == 1)
+            printf "(def {l} {%d \"s%d\" (x y) {head {1 2 3}}})\n", j, j
+        else
+            printf "(def {m} (from-list {\"k\" %d \"v\" \"t%d\"}))\n", j, j
+    }
+}' > "$tmp/corpus.alba"
+echo "(load \"$tmp/corpus.alba\")" > "$tmp/main.alba"
+
+"$1" "$tmp/main.alba" > /dev/null # warm the page cache
+rm -f "$tmp/corpus.albac"
+for run in cold warm; do
+    start=$(date +%s%N)
+    "$1" "$tmp/main.alba" > "$tmp/$run.out"
+    end=$(date +%s%N)
+    echo "$run load: $(( (end - start) / 1000000 )) ms for $lines lines"
+done
+if [ ! -f "$tmp/corpus.albac" ] || ! cmp -s "$tmp/cold.out" "$tmp/warm.out"; then
+    echo "cache not written or not matching the parsed forms" >&2
+    exit 1
+fi
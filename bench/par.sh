@@ -0,0 +1,33 @@
+#!/bin/sh
+# scaling of parallel builtins with the number of threads
+#  usage: bench/par.sh BINARY [ELEMENTS] [WORK]
+#  NB: pmap and pfor apply a function looping WORK times to every
+#      element (the loop is evaluated as part of the function, see
+#      lval_apply), with ALBA_THREADS set to 1, 2, 4, 8 and 16.
+if [ $# -lt 1 ]; then
+    echo "usage: $0 BINARY [ELEMENTS] [WORK]" >&2
+    exit 2
+fi
+n=${2:-256}
+work=${3:-20000}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+cat > "$tmp/par.alba" <<END
+(def {xs} (collect (range $n)))
+(def {f} {+ (fold {a x} 0 (range $work) {+ a x})})
+(pmap f xs)
+(pfor f xs)
+END
+
+base=
+for threads in 1 2 4 8 16; do
+    start=$(date +%s%N)
+    ALBA_THREADS=$threads "$1" "$tmp/par.alba" > /dev/null
+    end=$(date +%s%N)
+    ms=$(( (end - start) / 1000000 ))
+    [ -z "$base" ] && base=$ms
+    awk -v t="$threads" -v ms="$ms" -v base="$base" 'BEGIN {
+        printf "%d threads: %d ms, speedup %.2f\n", t, ms, base / (ms > 0 ? ms : 1)
+    }'
+done
@@ -0,0 +1,29 @@
+#!/bin/sh
+# memory of tail calls: peak resident size against loop length
+#  usage: bench/tailcall.sh BINARY
+#  NB: runs the tail recursive loop of tests/tailcall.alba for 10^4
+#      to 10^6 iterations on every engine; the peak resident size
+#      (measured with python3) has to stay flat.
+if [ $# -lt 1 ]; then
+    echo "usage: $0 BINARY" >&2
+    exit 2
+fi
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+for n in 10000 100000 1000000; do
+    cat > "$tmp/tailcall.alba" <<END
+(def {n} $n)
+(def {stop} (from-list {0 {n}}))
+(def {loop} {eval (get stop n {eval (head (list loop (def {n} (- n 1))))})})
+(eval loop)
+END
+    for engine in "" --vm --stack; do
+        python3 -c '
+import resource, subprocess, sys
+subprocess.run(sys.argv[1:], stdout=subprocess.DEVNULL, check=True)
+print(resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss, end="")
+' "$1" $engine "$tmp/tailcall.alba" > "$tmp/rss"
+        echo "$n iterations ${engine:-tree}: $(cat "$tmp/rss") KB peak"
+    done
+done
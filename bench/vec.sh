@@ -0,0 +1,34 @@
+#!/bin/sh
+# vector kernels: SIMD lanes against the scalar fallback
+#  usage: bench/vec.sh SIMD_BINARY SCALAR_BINARY [LENGTH] [ROUNDS]
+#  NB: the scalar binary is built with -DALBA_VEC_SCALAR. Both run
+#      ROUNDS rounds of element-wise arithmetic, dot products, sums,
+#      minimums, prefix scans and masked filters over vectors of
+#      LENGTH elements, built once up front.
+if [ $# -lt 2 ]; then
+    echo "usage: $0 SIMD_BINARY SCALAR_BINARY [LENGTH] [ROUNDS]" >&2
+    exit 2
+fi
+n=${3:-100000}
+rounds=${4:-200}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+cat > "$tmp/vec.alba" <<END
+(def {v} (vec (collect (range $n))))
+(def {w} (+ (* v 3) 1))
+(def {m} (- v (* (/ v 2) 2)))
+(dotimes {i} $rounds {+ (* v w) (- w v)})
+(dotimes {i} $rounds {dot v w})
+(dotimes {i} $rounds {sum w})
+(dotimes {i} $rounds {min w})
+(dotimes {i} $rounds {scan v})
+(dotimes {i} $rounds {filter-mask w m})
+END
+
+for bin in "$1" "$2"; do
+    start=$(date +%s%N)
+    "$bin" "$tmp/vec.alba" > /dev/null
+    end=$(date +%s%N)
+    echo "$bin: $(( (end - start) / 1000000 )) ms"
+done
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <unistd.h>
+
+#include "core.h"
+#include "expr.h"
+#include "env.h"
+#include "eval.h"
+#include "seq.h"
+#include "vec.h"
+#include "loop.h"
+#include "green.h"
+#include "memo.h"
+#include "deps.h"
+#include "module.h"
+#include "lassert.h"
+
+/**********************************************************/
+/*                        actors                          */
+/*--------------------------------------------------------*/
+/* NB: an actor is an interpreter of its own, running on  */
+/*     a thread of its own (pinned to a core where the    */
+/*     system allows it). It has its own copy of the      */
+/*     environment it was created in, its own free lval   */
+/*     cells, event loop and green threads, and shares    */
+/*     nothing with other threads but strings (see        */
+/*     lval_clone). It applies its function to every      */
+/*     message it receives, in order.                     */
+/*     Messages are deep copies made by the sender, and   */
+/*     replies deep copies made by the actor. Mailboxes   */
+/*     are lock-free queues with many producers and the   */
+/*     actor as only consumer; a semaphore counts the     */
+/*     messages so that idle actors sleep.                */
+/*     Actors run until the repl exits. Actors asking     */
+/*     each other in a circle wait forever.               */
+/**********************************************************/
+
+// maximum number of actors
+#ifndef ACTOR_MAX
+#define ACTOR_MAX 4096
+#endif
+
+// reply to ask
+typedef struct {
+    sem_t done;
+    lval_t* val;
+} actor_reply_t;
+
+// message (a NULL val stops the actor)
+typedef struct actor_msg_t {
+    struct actor_msg_t* next;
+    lval_t* val;
+    actor_reply_t* reply;  // NULL for tell
+} actor_msg_t;
+
+// actor
+typedef struct {
+    int id;
+    pthread_t thread;
+    env_t* env;
+    lval_t* fn;
+    // mailbox
+    actor_msg_t* head;    // last pushed (producers)
+    actor_msg_t* tail;    // next to pop (actor)
+    actor_msg_t stub;
+    sem_t pending;
+} actor_t;
+
+// actors by id
+//  NB: ids are handed out atomically, and an actor is published
+//      (with release ordering) once it is fully set up
+actor_t* actor_table[ACTOR_MAX];
+int actor_count = 0;
+
+// actor running on current thread (NULL if none)
+__thread actor_t* actor_self = NULL;
+
+/***********/
+/* mailbox */
+/***********/
+
+// push message (from any thread)
+void actor_push(actor_t* a, actor_msg_t* m) {
+    m->next = NULL;
+    actor_msg_t* prev = __atomic_exchange_n(&a->head, m, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, m, __ATOMIC_RELEASE);
+}
+
+// pop message (from the actor only)
+//  NB: returns NULL if the queue is empty, or if a push is halfway done
+actor_msg_t* actor_pop(actor_t* a) {
+    actor_msg_t* tail = a->tail;
+    actor_msg_t* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    // skip stub
+    if (tail == &a->stub) {
+        if (!next) return NULL;
+        a->tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        a->tail = next;
+        return tail;
+    }
+
+    // tail is last: put stub back behind it before taking it
+    if (tail != __atomic_load_n(&a->head, __ATOMIC_ACQUIRE)) return NULL;
+    actor_push(a, &a->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        a->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+// send message to actor
+void actor_send(actor_t* a, lval_t* val, actor_reply_t* reply) {
+    actor_msg_t* m = malloc(sizeof(actor_msg_t));
+    m->val = val;
+    m->reply = reply;
+    actor_push(a, m);
+    sem_post(&a->pending);
+}
+
+/*********/
+/* actor */
+/*********/
+
+// actor thread: apply function to messages until stopped
+void* actor_run(void* arg) {
+    actor_t* a = arg;
+    actor_self = a;
+
+    while (1) {
+        while (sem_wait(&a->pending) < 0) {}
+        actor_msg_t* m;
+        while (!(m = actor_pop(a))) sched_yield();
+
+        if (!m->val) {
+            free(m);
+            break;
+        }
+
+        lval_t* ret = lval_apply(a->env, a->fn, 1, &m->val);
+        if (m->reply) {
+            m->reply->val = lval_clone(ret);
+            sem_post(&m->reply->done);
+        }
+        lval_del(ret);
+        free(m);
+    }
+
+    // release everything owned by this thread
+    memo_shutdown();
+    deps_shutdown();
+    module_shutdown();
+    green_shutdown();
+    io_shutdown();
+    env_del(a->env);
+    lval_del(a->fn);
+    lval_freelist_drain();
+    return NULL;
+}
+
+// actor with given id (NULL if none)
+actor_t* actor_get(const lval_t* id) {
+    if (id->type != LVAL_NUM || id->num < 0 || id->num >= ACTOR_MAX)
+        return NULL;
+    return __atomic_load_n(&actor_table[id->num], __ATOMIC_ACQUIRE);
+}
+
+// stop all actors and wait for them
+//  NB: only called by the repl's thread, once nothing else runs
+void actor_shutdown(void) {
+    int count = __atomic_load_n(&actor_count, __ATOMIC_ACQUIRE);
+    if (count > ACTOR_MAX) count = ACTOR_MAX;
+
+    for (int j = 0; j < count; ++j)
+        if (actor_table[j]) actor_send(actor_table[j], NULL, NULL);
+    for (int j = 0; j < count; ++j) {
+        actor_t* a = actor_table[j];
+        if (!a) continue;
+        pthread_join(a->thread, NULL);
+        sem_destroy(&a->pending);
+        free(a);
+        actor_table[j] = NULL;
+    }
+    actor_count = 0;
+}
+
+/************/
+/* builtins */
+/************/
+
+// actor (start actor applying function to its messages, returns its id)
+lval_t* builtin_actor(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "actor");
+    LASSERTV(seq_is_fn(argv[0]), "'actor' needs to be passed a function");
+
+    int id = __atomic_fetch_add(&actor_count, 1, __ATOMIC_ACQ_REL);
+    LASSERTV(id < ACTOR_MAX, "too many actors!");
+
+    // make selection of vector kernels before threads race for it
+    vec_kernels();
+
+    actor_t* a = calloc(1, sizeof(actor_t));
+    a->id = id;
+    a->env = env_clone(env);
+    a->fn = lval_clone(argv[0]);
+    a->head = a->tail = &a->stub;
+    sem_init(&a->pending, 0, 0);
+    pthread_create(&a->thread, NULL, &actor_run, a);
+
+#ifdef __linux__
+    // pin to a core, spreading actors over all of them
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(id % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+    pthread_setaffinity_np(a->thread, sizeof(cpus), &cpus);
+#endif
+
+    __atomic_store_n(&actor_table[id], a, __ATOMIC_RELEASE);
+    return lval_num(id);
+}
+
+// tell (send message to actor without waiting)
+lval_t* builtin_tell(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 2, 2, "tell");
+    actor_t* a = actor_get(argv[0]);
+    LASSERTV(a, "'tell' needs to be passed an actor first");
+
+    actor_send(a, lval_clone(argv[1]), NULL);
+    return lval_sexpr();
+}
+
+// ask (send message to actor and wait for its reply)
+lval_t* builtin_ask(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 2, 2, "ask");
+    actor_t* a = actor_get(argv[0]);
+    LASSERTV(a, "'ask' needs to be passed an actor first");
+    LASSERTV(a != actor_self, "actor cannot ask itself!");
+
+    actor_reply_t reply;
+    sem_init(&reply.done, 0, 0);
+    actor_send(a, lval_clone(argv[1]), &reply);
+    while (sem_wait(&reply.done) < 0) {}
+    sem_destroy(&reply.done);
+    return reply.val;
+}
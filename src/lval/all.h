@@ -6,3 +6,20 @@
 #include "eval.h"
 #include "env.h"
 #include "print.h"
+#include "closure.h"
+#include "jit.h"
+#include "vm.h"
+#include "machine.h"
+#include "optimize.h"
+#include "seq.h"
+#include "pool.h"
+#include "par.h"
+#include "loop.h"
+#include "green.h"
+#include "actor.h"
+#include "files.h"
+#include "memo.h"
+#include "loops.h"
+#include "deps.h"
+#include "module.h"
+#include "image.h"
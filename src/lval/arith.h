@@ -0,0 +1,182 @@
+#pragma once
+
+#include <limits.h>
+
+#include "core.h"
+
+/**********************************************************/
+/*                   arithmetic kernels                   */
+/*--------------------------------------------------------*/
+/* NB: operators are resolved once into an arith_op_t and */
+/*     run over a contiguous array of operands.           */
+/*     Semantics (left to right, like the builtins):      */
+/*     - the result is an error if the exact mathematical */
+/*       result does not fit in a long ("integer          */
+/*       overflow!"), even if some intermediate value     */
+/*       would not have fit either                        */
+/*     - division truncates towards 0, dividing by 0 is   */
+/*       an error and so is LONG_MIN / -1 (overflow)      */
+/*     - a single operand is returned as is, apart from   */
+/*       '-' which negates it                             */
+/**********************************************************/
+
+// arithmetic operators
+typedef enum {
+    ARITH_ADD,
+    ARITH_SUB,
+    ARITH_MUL,
+    ARITH_DIV
+} arith_op_t;
+
+// outcome of kernels
+typedef enum {
+    ARITH_OK,
+    ARITH_OVERFLOW,
+    ARITH_DIV_ZERO
+} arith_status_t;
+
+// exact sum: value is lo + wraps * 2^64
+typedef struct {
+    long lo;
+    long wraps;
+} arith_wide_t;
+
+// add x to wide sum
+void arith_wide_add(arith_wide_t* w, long x) {
+    if (__builtin_add_overflow(w->lo, x, &w->lo))
+        w->wraps += x > 0 ? 1 : -1;
+}
+
+// subtract x from wide sum
+void arith_wide_sub(arith_wide_t* w, long x) {
+    if (__builtin_sub_overflow(w->lo, x, &w->lo))
+        w->wraps += x < 0 ? 1 : -1;
+}
+
+// exact sum of xs[0..n)
+//  NB: four lanes are summed with SIMD as long as no lane overflows,
+//      otherwise the sum is redone one element at a time
+arith_wide_t arith_sum(const long* xs, int n) {
+    arith_wide_t w = { 0, 0 };
+    int j = 0;
+
+#if defined(__GNUC__)
+    typedef unsigned long vec_t __attribute__((vector_size(32)));
+    vec_t acc = { 0, 0, 0, 0 };
+    vec_t ovf = { 0, 0, 0, 0 };
+
+    for (; j + 4 <= n; j += 4) {
+        vec_t x;
+        memcpy(&x, xs + j, sizeof(x));
+        vec_t r = acc + x;
+        // signed overflow: operands of same sign, result of other sign
+        ovf |= (acc ^ r) & (x ^ r);
+        acc = r;
+    }
+
+    if ((long) (ovf[0] | ovf[1] | ovf[2] | ovf[3]) < 0) {
+        j = 0;
+    } else {
+        for (int l = 0; l < 4; ++l)
+            arith_wide_add(&w, (long) acc[l]);
+    }
+#endif
+
+    for (; j < n; ++j)
+        arith_wide_add(&w, xs[j]);
+
+    return w;
+}
+
+// true if any of xs[0..n) is 0
+int arith_any_zero(const long* xs, int n) {
+    int j = 0;
+
+#if defined(__GNUC__)
+    typedef long vec_t __attribute__((vector_size(32)));
+    for (; j + 4 <= n; j += 4) {
+        vec_t x;
+        memcpy(&x, xs + j, sizeof(x));
+        vec_t z = x == 0;
+        if (z[0] | z[1] | z[2] | z[3]) return 1;
+    }
+#endif
+
+    for (; j < n; ++j)
+        if (xs[j] == 0) return 1;
+
+    return 0;
+}
+
+// exact product of xs[0..n)
+arith_status_t arith_product(const long* xs, int n, long* out) {
+    if (arith_any_zero(xs, n)) {
+        *out = 0;
+        return ARITH_OK;
+    }
+
+    // no zeros: magnitude never decreases, so once it does not fit
+    // the final result does not either
+    unsigned long mag = 1;
+    int neg = 0;
+    for (int j = 0; j < n; ++j) {
+        unsigned long x = xs[j] < 0 ? -(unsigned long) xs[j] : xs[j];
+        neg ^= xs[j] < 0;
+        if (__builtin_mul_overflow(mag, x, &mag))
+            return ARITH_OVERFLOW;
+    }
+
+    if (neg) {
+        if (mag > (unsigned long) LONG_MAX + 1) return ARITH_OVERFLOW;
+        *out = (long) -mag;
+    } else {
+        if (mag > (unsigned long) LONG_MAX) return ARITH_OVERFLOW;
+        *out = (long) mag;
+    }
+    return ARITH_OK;
+}
+
+// apply operator to xs[0..n) (n > 0)
+arith_status_t arith_apply(arith_op_t op, const long* xs, int n, long* out) {
+    arith_wide_t w = { 0, 0 };
+
+    // single operand
+    if (n == 1) {
+        if (op != ARITH_SUB) { *out = xs[0]; return ARITH_OK; }
+        if (xs[0] == LONG_MIN) return ARITH_OVERFLOW;
+        *out = -xs[0];
+        return ARITH_OK;
+    }
+
+    switch (op) {
+        case ARITH_ADD:
+            w = arith_sum(xs, n);
+            break;
+        case ARITH_SUB: {
+            arith_wide_t rest = arith_sum(xs + 1, n - 1);
+            w.lo = xs[0];
+            w.wraps = -rest.wraps;
+            arith_wide_sub(&w, rest.lo);
+            break;
+        }
+        case ARITH_MUL:
+            return arith_product(xs, n, out);
+        case ARITH_DIV: {
+            long acc = xs[0];
+            for (int j = 1; j < n; ++j) {
+                if (xs[j] == 0) return ARITH_DIV_ZERO;
+                if (acc == LONG_MIN && xs[j] == -1) return ARITH_OVERFLOW;
+                acc /= xs[j];
+            }
+            *out = acc;
+            return ARITH_OK;
+        }
+        default:
+            assert(0 && "trying to apply unknown arithmetic operator");
+            return ARITH_OVERFLOW;
+    }
+
+    if (w.wraps != 0) return ARITH_OVERFLOW;
+    *out = w.lo;
+    return ARITH_OK;
+}
@@ -2,13 +2,21 @@
 
 #include "core.h"
 #include "lassert.h"
+#include "arith.h"
+#include "vec.h"
+#include "rope.h"
+#include "map.h"
 
 /**********************************************************/
 /*          builtin operators and functions               */
 /*--------------------------------------------------------*/
-/* NB: all builtin functions expect an s-expression       */
-/*     as their sole parameter. This expression countains */
-/*     every piece of input that the operator requires.   */
+/* NB: builtin functions (builtin_t) expect an            */
+/*     s-expression as their sole parameter. This         */
+/*     expression countains every piece of input that the */
+/*     operator requires and is consumed by the builtin.  */
+/*     Borrowing builtins (builtinv_t) instead read their */
+/*     arguments in place from the evaluator (argc/argv)  */
+/*     and never take ownership of them.                  */
 /**********************************************************/
 
 // forward declarations
@@ -31,7 +39,7 @@ lval_t* builtin_def(env_t* env, lval_t* args) {
     // ensure that all variables are symbols
     for (int j = 0; j < vars->count; ++j) {
         if (vars->cell[j]->type != LVAL_SYM) {
-            lval_del(args);
+            lval_del(vars); lval_del(args);
             return lval_err("only symbols may be used as variables.");
         }
     }
@@ -60,36 +68,34 @@ lval_t* builtin_def(env_t* env, lval_t* args) {
 /* q-expression functions */
 /**************************/
 // head
-lval_t* builtin_head(env_t* env, lval_t* args) {
+lval_t* builtin_head(env_t* env, int argc, lval_t* const* argv) {
     // check for errors
-    LASSERT_BOUNDS(args, 1, 1, "head");
-    LASSERT_TYPES(args, LVAL_QEXPR, "head");
-    LASSERT(args->cell[0]->count > 0, args,
+    LASSERTV_BOUNDS(argc, 1, 1, "head");
+    LASSERTV_TYPES(argv, LVAL_QEXPR, "head");
+    LASSERTV(argv[0]->count > 0,
         "cannot take the 'head' of an empty list!");
 
-    // take q-expression from arguments
-    lval_t* lst = lval_take(args, 0);
-
-    // take the head and return it
-    return lval_take(lst, 0);
+    // return copy of the head
+    return lval_copy(argv[0]->cell[0]);
 }
 
 // tail
-lval_t* builtin_tail(env_t* env, lval_t* args){
+lval_t* builtin_tail(env_t* env, int argc, lval_t* const* argv) {
     // check for errors
-    LASSERT_BOUNDS(args, 1, 1, "tail");
-    LASSERT_TYPES(args, LVAL_QEXPR, "tail");
-    LASSERT(args->cell[0]->count > 0, args,
+    LASSERTV_BOUNDS(argc, 1, 1, "tail");
+    LASSERTV_TYPES(argv, LVAL_QEXPR, "tail");
+    LASSERTV(argv[0]->count > 0,
             "cannot take the 'tail' of an empty list!");
 
-    // take q-expression from arguments
-    lval_t* lst = lval_take(args, 0);
+    // copy rest of the list
+    const lval_t* lst = argv[0];
+    lval_t* ret = lval_qexpr();
+    ret->count = lst->count - 1;
+    ret->cell = ret->count ? malloc(sizeof(lval_t*) * ret->count) : NULL;
+    for (int j = 0; j < ret->count; ++j)
+        ret->cell[j] = lval_copy(lst->cell[j + 1]);
 
-    // pop head from list and deallocate it
-    lval_t* head = lval_pop(lst, 0); lval_del(head);
-
-    // return rest of the list
-    return lst;
+    return ret;
 }
 
 // list
@@ -110,69 +116,318 @@ lval_t* builtin_eval(env_t* env, lval_t* args) {
     lval_t* toEval = lval_take(args, 0);
 
     // evaluate it as if it was an s-expression
-    toEval->type = LVAL_SEXPR;
-    return lval_eval(env, toEval);
+    //  NB: the evaluation is handed back to the caller's trampoline
+    //      (lval_force) as a tail call, so that chains of evals run
+    //      in constant C stack space
+    return lval_tail(toEval);
 }
 
 /************************/
 /* arithmetic operators */
 /************************/
-// real work
-lval_t* builtin_op(const char* op, lval_t* args) {
-    // ensure all arguments are numbers
-    for (int j = 0; j < args->count; ++j) {
-        if (args->cell[j]->type != LVAL_NUM) {
-            lval_del(args);
-            return lval_err("cannot operate on non-number!");
-        }
-    }
+// lval from outcome of arithmetic kernel
+lval_t* builtin_arith_err(arith_status_t status) {
+    return status == ARITH_DIV_ZERO ? lval_err("cannot perform division by 0!") :
+                                      lval_err("integer overflow!");
+}
 
-    // take first element
-    lval_t* acc = lval_pop(args, 0);
+// element-wise work on vectors of length n (numbers are broadcast)
+lval_t* builtin_vec_op(arith_op_t op, int argc, lval_t* const* argv, int n) {
+    for (int j = 0; j < argc; ++j) {
+        LASSERTV(argv[j]->type == LVAL_VEC || argv[j]->type == LVAL_NUM,
+                 "cannot operate on non-number!");
+        LASSERTV(argv[j]->type != LVAL_VEC || argv[j]->len == n,
+                 "cannot operate on vectors of different lengths!");
+    }
 
-    // unary minus
-    if (args->count == 0 && strcmp(op, "-") == 0) {
-        acc->num = -acc->num;
-        lval_del(args);
-        return acc;
+    long* out = n ? malloc(sizeof(long) * n) : NULL;
+    arith_status_t status = vec_apply(op, argc, argv, n, out);
+    if (status != ARITH_OK) {
+        free(out);
+        return builtin_arith_err(status);
     }
+    return lval_vec(out, n);
+}
 
-    // more than one element
-    while (args->count) {
-        lval_t* numv = lval_pop(args, 0);
-
-        // match operator
-        if      (strcmp(op, "+") == 0) acc->num += numv->num;
-        else if (strcmp(op, "-") == 0) acc->num -= numv->num;
-        else if (strcmp(op, "*") == 0) acc->num *= numv->num;
-        else if (strcmp(op, "/") == 0) {
-            if (numv->num == 0) {
-                lval_del(acc); lval_del(numv);
-                acc = lval_err("cannot perform division by 0!");
-                break;
-            }
-            else
-                acc->num /= numv->num;
+// real work
+lval_t* builtin_op(arith_op_t op, int argc, lval_t* const* argv) {
+    LASSERTV(argc > 0, "arithmetic operator called with no arguments");
+
+    // gather operands into contiguous buffer, ensuring they are numbers
+    //  NB: vectors among operands are operated on element-wise
+    long buf[64];
+    long* nums = argc <= 64 ? buf : malloc(sizeof(long) * argc);
+    for (int j = 0; j < argc; ++j) {
+        if (argv[j]->type != LVAL_NUM) {
+            if (nums != buf) free(nums);
+            return argv[j]->type == LVAL_VEC ?
+                builtin_vec_op(op, argc, argv, argv[j]->len) :
+                lval_err("cannot operate on non-number!");
         }
+        nums[j] = argv[j]->num;
     }
 
-    lval_del(args); return acc;
+    // run kernel
+    long acc = 0;
+    arith_status_t status = arith_apply(op, nums, argc, &acc);
+    if (nums != buf) free(nums);
+
+    return status == ARITH_OK ? lval_num(acc) : builtin_arith_err(status);
 }
 
 // dispatchers
 // add
-lval_t* builtin_add(env_t* env, lval_t* args) {
-    return builtin_op("+", args);
+lval_t* builtin_add(env_t* env, int argc, lval_t* const* argv) {
+    return builtin_op(ARITH_ADD, argc, argv);
 }
 // subtract
-lval_t* builtin_subtract(env_t* env, lval_t* args) {
-    return builtin_op("-", args);
+lval_t* builtin_subtract(env_t* env, int argc, lval_t* const* argv) {
+    return builtin_op(ARITH_SUB, argc, argv);
 }
 // multiply
-lval_t* builtin_multiply(env_t* env, lval_t* args) {
-    return builtin_op("*", args);
+lval_t* builtin_multiply(env_t* env, int argc, lval_t* const* argv) {
+    return builtin_op(ARITH_MUL, argc, argv);
 }
 // divide
-lval_t* builtin_divide(env_t* env, lval_t* args) {
-    return builtin_op("/", args);
+lval_t* builtin_divide(env_t* env, int argc, lval_t* const* argv) {
+    return builtin_op(ARITH_DIV, argc, argv);
+}
+
+/********************/
+/* vector functions */
+/********************/
+// vec
+//  NB: takes numbers or a single q-expression of numbers
+lval_t* builtin_vec(env_t* env, int argc, lval_t* const* argv) {
+    if (argc == 1 && argv[0]->type == LVAL_QEXPR) {
+        argc = argv[0]->count;
+        argv = argv[0]->cell;
+    }
+
+    long* vec = argc ? malloc(sizeof(long) * argc) : NULL;
+    for (int j = 0; j < argc; ++j) {
+        if (argv[j]->type != LVAL_NUM) {
+            free(vec);
+            return lval_err("'vec' can only be made of numbers!");
+        }
+        vec[j] = argv[j]->num;
+    }
+    return lval_vec(vec, argc);
+}
+
+// len
+lval_t* builtin_len(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "len");
+    LASSERTV_TYPES(argv, LVAL_VEC, "len");
+    return lval_num(argv[0]->len);
+}
+
+// sum
+lval_t* builtin_sum(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "sum");
+    LASSERTV_TYPES(argv, LVAL_VEC, "sum");
+
+    long ret = 0;
+    arith_status_t status = vec_sum(argv[0]->vec, argv[0]->len, &ret);
+    return status == ARITH_OK ? lval_num(ret) : builtin_arith_err(status);
+}
+
+// dot
+lval_t* builtin_dot(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 2, 2, "dot");
+    LASSERTV(argv[0]->type == LVAL_VEC && argv[1]->type == LVAL_VEC,
+             "'dot' needs to be passed two vectors");
+    LASSERTV(argv[0]->len == argv[1]->len,
+             "cannot operate on vectors of different lengths!");
+
+    long ret = 0;
+    arith_status_t status = vec_dot(argv[0]->vec, argv[1]->vec,
+                                    argv[0]->len, &ret);
+    return status == ARITH_OK ? lval_num(ret) : builtin_arith_err(status);
+}
+
+// min and max of a vector
+lval_t* builtin_minmax(int argc, lval_t* const* argv, int max) {
+    LASSERTV(argc == 1 && argv[0]->type == LVAL_VEC,
+             "'min' and 'max' need to be passed a single vector");
+    LASSERTV(argv[0]->len > 0,
+             "cannot take the 'min' or 'max' of an empty vector!");
+
+    return lval_num(vec_kernels()->minmax(argv[0]->vec, argv[0]->len, max));
+}
+lval_t* builtin_min(env_t* env, int argc, lval_t* const* argv) {
+    return builtin_minmax(argc, argv, 0);
+}
+lval_t* builtin_max(env_t* env, int argc, lval_t* const* argv) {
+    return builtin_minmax(argc, argv, 1);
+}
+
+// scan (inclusive prefix sums)
+lval_t* builtin_scan(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "scan");
+    LASSERTV_TYPES(argv, LVAL_VEC, "scan");
+
+    int n = argv[0]->len;
+    long* out = n ? malloc(sizeof(long) * n) : NULL;
+    if (vec_kernels()->scan(argv[0]->vec, out, n)) {
+        free(out);
+        return lval_err("integer overflow!");
+    }
+    return lval_vec(out, n);
+}
+
+// filter-mask (elements whose mask is not 0)
+lval_t* builtin_filter_mask(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 2, 2, "filter-mask");
+    LASSERTV(argv[0]->type == LVAL_VEC && argv[1]->type == LVAL_VEC,
+             "'filter-mask' needs to be passed two vectors");
+    LASSERTV(argv[0]->len == argv[1]->len,
+             "cannot operate on vectors of different lengths!");
+
+    int n = argv[0]->len;
+    long* out = n ? malloc(sizeof(long) * n) : NULL;
+    int m = vec_filter(argv[0]->vec, argv[1]->vec, n, out);
+    if (m == 0) { free(out); out = NULL; }
+    return lval_vec(out, m);
+}
+
+/********************/
+/* string functions */
+/********************/
+// str-cat
+lval_t* builtin_str_cat(env_t* env, int argc, lval_t* const* argv) {
+    for (int j = 0; j < argc; ++j)
+        LASSERTV(argv[j]->type == LVAL_STR,
+                 "'str-cat' can only concatenate strings!");
+
+    rope_t* ret = rope_flat("", 0);
+    for (int j = 0; j < argc; ++j)
+        ret = rope_concat(ret, rope_retain(argv[j]->str));
+    return lval_str(ret);
+}
+
+// str-len
+lval_t* builtin_str_len(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "str-len");
+    LASSERTV_TYPES(argv, LVAL_STR, "str-len");
+    return lval_num(argv[0]->str->len);
+}
+
+// str-at (string of the character at an index)
+lval_t* builtin_str_at(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 2, 2, "str-at");
+    LASSERTV_TYPES(argv, LVAL_STR, "str-at");
+    LASSERTV(argv[1]->type == LVAL_NUM,
+             "'str-at' needs to be passed a number as index");
+    LASSERTV(argv[1]->num >= 0 && argv[1]->num < argv[0]->str->len,
+             "string index out of bounds!");
+
+    char c = rope_at(argv[0]->str, argv[1]->num);
+    return lval_str(rope_flat(&c, 1));
+}
+
+// str-slice (characters from start up to end, excluded)
+lval_t* builtin_str_slice(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 3, 3, "str-slice");
+    LASSERTV_TYPES(argv, LVAL_STR, "str-slice");
+    LASSERTV(argv[1]->type == LVAL_NUM && argv[2]->type == LVAL_NUM,
+             "'str-slice' needs to be passed numbers as bounds");
+
+    long start = argv[1]->num, end = argv[2]->num;
+    LASSERTV(0 <= start && start <= end && end <= argv[0]->str->len,
+             "string slice out of bounds!");
+
+    return lval_str(rope_slice(argv[0]->str, start, end));
+}
+
+/*****************/
+/* map functions */
+/*****************/
+// from-list (map from q-expression of alternating keys and values)
+lval_t* builtin_from_list(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "from-list");
+    LASSERTV_TYPES(argv, LVAL_QEXPR, "from-list");
+    LASSERTV(argv[0]->count % 2 == 0,
+             "'from-list' needs to be passed keys along with values");
+
+    const lval_t* lst = argv[0];
+    hmap_t* m = hmap_new();
+    for (int j = 0; j < lst->count; j += 2)
+        hmap_put(m, lval_copy(lst->cell[j]), lval_copy(lst->cell[j + 1]));
+    return lval_map(m);
+}
+
+// get (value bound to key, default or nil if none)
+lval_t* builtin_get(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 2, 3, "get");
+    LASSERTV_TYPES(argv, LVAL_MAP, "get");
+
+    lval_t* val = hmap_get(argv[0]->map, argv[1]);
+    if (val) return lval_copy(val);
+    return argc == 3 ? lval_copy(argv[2]) : lval_nil();
+}
+
+// make table of map lval safe to modify
+//  NB: the table is copied only if other maps share it
+void builtin_map_own(lval_t* m) {
+    if (m->map->refs > 1) {
+        hmap_t* own = hmap_clone(m->map, &lval_copy);
+        hmap_release(m->map);
+        m->map = own;
+    }
+}
+
+// assoc (map with keys bound to values)
+lval_t* builtin_assoc(env_t* env, lval_t* args) {
+    LASSERT_AT_LEAST(args, 1, "assoc");
+    LASSERT_TYPES(args, LVAL_MAP, "assoc");
+    LASSERT(args->count % 2 == 1, args,
+            "'assoc' needs to be passed keys along with values");
+
+    lval_t* m = lval_pop(args, 0);
+    builtin_map_own(m);
+
+    // move pairs into map
+    for (int j = 0; j < args->count; j += 2)
+        hmap_put(m->map, args->cell[j], args->cell[j + 1]);
+    args->count = 0;
+    lval_del(args);
+
+    return m;
+}
+
+// dissoc (map without keys)
+lval_t* builtin_dissoc(env_t* env, lval_t* args) {
+    LASSERT_AT_LEAST(args, 1, "dissoc");
+    LASSERT_TYPES(args, LVAL_MAP, "dissoc");
+
+    lval_t* m = lval_pop(args, 0);
+    builtin_map_own(m);
+
+    for (int j = 0; j < args->count; ++j)
+        hmap_remove(m->map, args->cell[j]);
+    lval_del(args);
+
+    return m;
+}
+
+// keys and vals (q-expression of keys or values, in table order)
+lval_t* builtin_entries(int argc, lval_t* const* argv, int vals) {
+    LASSERTV(argc == 1 && argv[0]->type == LVAL_MAP,
+             "'keys' and 'vals' need to be passed a single map");
+
+    const hmap_t* m = argv[0]->map;
+    lval_t* ret = lval_qexpr();
+    ret->cell = m->count ? malloc(sizeof(lval_t*) * m->count) : NULL;
+    for (int j = 0; j < m->cap; ++j)
+        if (m->slots[j].key)
+            ret->cell[ret->count++] = lval_copy(vals ? m->slots[j].val :
+                                                       m->slots[j].key);
+    return ret;
+}
+lval_t* builtin_keys(env_t* env, int argc, lval_t* const* argv) {
+    return builtin_entries(argc, argv, 0);
+}
+lval_t* builtin_vals(env_t* env, int argc, lval_t* const* argv) {
+    return builtin_entries(argc, argv, 1);
 }
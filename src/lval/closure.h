@@ -0,0 +1,250 @@
+#pragma once
+
+#include "core.h"
+#include "expr.h"
+#include "env.h"
+#include "eval.h"
+
+/**********************************************************/
+/*                    closure compiler                    */
+/*--------------------------------------------------------*/
+/* NB: a form is compiled once into a tree of nodes, each */
+/*     one being a C function pointer plus the operands   */
+/*     it captured at compile time. Running the tree      */
+/*     skips the type switch of lval_eval, repeated       */
+/*     symbol lookups and the rebuilding of the argument  */
+/*     s-expression out of the source form.               */
+/**********************************************************/
+
+// compiled node
+typedef struct cnode_t cnode_t;
+typedef lval_t* (*cnode_fn_t)(env_t*, cnode_t*);
+struct cnode_t {
+    cnode_fn_t fn;
+    lval_t* k;       // constant (or symbol for global references)
+    int argc;
+    cnode_t** args;  // callee followed by its arguments
+    env_t* env;      // environment the cached slot refers to
+    int slot;        // cached binding slot (-1 if unresolved)
+    int hits;        // number of runs (for tiering up to the JIT)
+    struct jit_code_t* jit;
+};
+
+// forward declarations
+struct jit_code_t;
+void jit_code_del(struct jit_code_t*);
+int jit_is_candidate(const lval_t*);
+lval_t* jit_cnode_arith(env_t*, cnode_t*);
+
+// free compiled node tree
+void cnode_del(cnode_t* n) {
+    if (n->k) lval_del(n->k);
+    for (int j = 0; j <= n->argc && n->args; ++j)
+        cnode_del(n->args[j]);
+    free(n->args);
+    if (n->jit) jit_code_del(n->jit);
+    free(n);
+}
+
+// run compiled node
+//  NB: call nodes may return a tail call
+lval_t* cnode_run(env_t* e, cnode_t* n) {
+    return n->fn(e, n);
+}
+
+/*********/
+/* nodes */
+/*********/
+
+// constant: evaluates to a copy of itself
+lval_t* cnode_const(env_t* e, cnode_t* n) {
+    return lval_copy(n->k);
+}
+
+// resolve global reference, caching the slot of the binding
+lval_t* cnode_resolve(env_t* e, cnode_t* n) {
+    if (env_reads) env_read(n->k->sym);
+    if (n->env != e || n->slot < 0) {
+        n->env = e;
+        n->slot = env_slot(e, n->k->sym);
+        if (n->slot < 0) return NULL;
+    }
+    return e->vals[n->slot];
+}
+
+// global reference: evaluates to a copy of the bound value
+lval_t* cnode_global(env_t* e, cnode_t* n) {
+    lval_t* val = cnode_resolve(e, n);
+    return val ? lval_copy(val) : lval_nil();
+}
+
+// evaluate arguments of call node into argv
+//  NB: returns the first error encountered (NULL if none), without
+//      evaluating the remaining arguments
+lval_t* cnode_argv(env_t* e, cnode_t* n, lval_t** argv) {
+    for (int j = 0; j < n->argc; ++j) {
+        lval_t* val = lval_force(e, cnode_run(e, n->args[j + 1]));
+        if (val->type == LVAL_ERR) {
+            while (j--) lval_del(argv[j]);
+            return val;
+        }
+        argv[j] = val;
+    }
+
+    return NULL;
+}
+
+// evaluate arguments of call node into a freshly sized s-expression
+//  NB: returns the first error encountered instead, if any
+lval_t* cnode_args(env_t* e, cnode_t* n) {
+    lval_t** cell = malloc(sizeof(lval_t*) * n->argc);
+    lval_t* err = cnode_argv(e, n, cell);
+    if (err) {
+        free(cell);
+        return err;
+    }
+
+    lval_t* args = lval_sexpr();
+    args->count = n->argc;
+    args->cell = cell;
+    return args;
+}
+
+// call of builtin bound to global symbol
+//  NB: arguments are evaluated into a buffer, from which borrowing
+//      builtins read them in place
+lval_t* cnode_call_global(env_t* e, cnode_t* n) {
+    // calls are charged to the budget of the evaluation, if any
+    if (!machine_charge()) return machine_starved();
+
+    lval_t* buf[16];
+    lval_t** argv = n->argc <= 16 ? buf : malloc(sizeof(lval_t*) * n->argc);
+
+    // resolve callee before the arguments, like the other engines
+    //  NB: arguments may rebind it, so only what the call needs of it
+    //      is kept: the function of a borrowing builtin, or a copy
+    lval_t* f = cnode_resolve(e, n->args[0]);
+    builtinv_t fv = f && f->type == LVAL_BUILTIN ? f->builtinv : NULL;
+    lval_t* callee = fv ? NULL : f ? lval_copy(f) : lval_nil();
+
+    lval_t* ret = cnode_argv(e, n, argv);
+    if (ret) {
+        if (callee) lval_del(callee);
+    } else if (fv) {
+        ret = fv(e, n->argc, argv);
+        for (int j = 0; j < n->argc; ++j)
+            lval_del(argv[j]);
+    } else {
+        lval_t* args = lval_sexpr();
+        args->count = n->argc;
+        args->cell = malloc(sizeof(lval_t*) * n->argc);
+        memcpy(args->cell, argv, sizeof(lval_t*) * n->argc);
+        ret = lval_call(e, callee, args);
+    }
+
+    if (argv != buf) free(argv);
+    return ret;
+}
+
+// call of arbitrary callee
+lval_t* cnode_call(env_t* e, cnode_t* n) {
+    if (!machine_charge()) return machine_starved();
+
+    lval_t* f = lval_force(e, cnode_run(e, n->args[0]));
+    if (f->type == LVAL_ERR) return f;
+
+    lval_t* args = cnode_args(e, n);
+    if (args->type == LVAL_ERR) {
+        lval_del(f);
+        return args;
+    }
+
+    return lval_call(e, f, args);
+}
+
+/************/
+/* compiler */
+/************/
+
+// allocate node
+cnode_t* cnode_new(cnode_fn_t fn, lval_t* k, int argc) {
+    cnode_t* n = malloc(sizeof(cnode_t));
+    n->fn = fn;
+    n->k = k;
+    n->argc = argc;
+    n->args = argc >= 0 ? malloc(sizeof(cnode_t*) * (argc + 1)) : NULL;
+    n->env = NULL;
+    n->slot = -1;
+    n->hits = 0;
+    n->jit = NULL;
+    return n;
+}
+
+// compile lval (borrowed) into node tree
+cnode_t* closure_compile_expr(const lval_t* v) {
+    switch (v->type) {
+        case LVAL_NUM: case LVAL_ERR: case LVAL_QEXPR: case LVAL_BUILTIN:
+        case LVAL_VEC: case LVAL_STR: case LVAL_MAP: case LVAL_SEQ:
+            return cnode_new(&cnode_const, lval_copy(v), -1);
+        case LVAL_SYM:
+            return cnode_new(&cnode_global, lval_copy(v), -1);
+        case LVAL_SEXPR:
+            break;
+        default:
+            assert(0 && "trying to compile lval of unknown type");
+    }
+
+    // 0 elements: evaluate to itself
+    if (v->count == 0)
+        return cnode_new(&cnode_const, lval_sexpr(), -1);
+
+    // 1 element: eliminate parentheses
+    if (v->count == 1)
+        return closure_compile_expr(v->cell[0]);
+
+    // 2 or more: call
+    //  NB: pure arithmetic can later be tiered up to native code
+    cnode_t* n = cnode_new(jit_is_candidate(v)         ? &jit_cnode_arith   :
+                           v->cell[0]->type == LVAL_SYM ? &cnode_call_global :
+                                                          &cnode_call,
+                           NULL, v->count - 1);
+    for (int j = 0; j < v->count; ++j)
+        n->args[j] = closure_compile_expr(v->cell[j]);
+
+    return n;
+}
+
+// compiled form of expression (borrowed), compiled on first use
+//  NB: the form stays alive as long as v (or a copy of it) does
+cnode_t* closure_code(env_t* e, lval_t* v) {
+    // attach cache and compile on first evaluation
+    if (!v->code) v->code = lval_code_new();
+    if (!v->code->root) {
+        // compile the form as an s-expression
+        //  NB: it is not optimized, as folding would keep the
+        //      bindings of the first run (see optimize.h)
+        lval_t* form = lval_copy(v);
+        form->type = LVAL_SEXPR;
+        v->code->root = closure_compile_expr(form);
+        lval_del(form);
+    }
+    return v->code->root;
+}
+
+// evaluate expression (consumed) through its cached compiled form
+//  NB: calls in tail position of the form are not forced, so the
+//      result may be a tail call (see lval_force)
+lval_t* closure_eval(env_t* e, lval_t* v) {
+    if (v->type != LVAL_SEXPR && v->type != LVAL_QEXPR)
+        return lval_eval(e, v);
+    closure_code(e, v);
+
+    // keep compiled form alive while running it
+    lval_code_t* code = v->code;
+    ++(code->refs);
+    lval_del(v);
+
+    lval_t* ret = cnode_run(e, code->root);
+    lval_code_release(code);
+    return ret;
+}
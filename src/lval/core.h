@@ -10,6 +10,11 @@ typedef struct lval_t lval_t;
 // and associate them with symbols
 typedef lval_t* (*builtin_t)(env_t*, lval_t*);
 
+// type used to store builtin functions that borrow their arguments
+//  NB: arguments are read straight from the evaluator (argc/argv)
+//      and stay owned by it, so they must not be modified or freed
+typedef lval_t* (*builtinv_t)(env_t*, int, lval_t* const*);
+
 // types of lvals
 typedef enum {
     LVAL_ERR,
@@ -17,7 +22,12 @@ typedef enum {
     LVAL_SYM,
     LVAL_BUILTIN,
     LVAL_SEXPR,
-    LVAL_QEXPR
+    LVAL_QEXPR,
+    LVAL_VEC,   // packed vector of numbers
+    LVAL_STR,   // rope string
+    LVAL_MAP,   // hash map
+    LVAL_SEQ,   // lazy sequence
+    LVAL_TAIL   // pending evaluation in tail position (never escapes eval)
 } LVAL_TYPE;
 
 // types of errors
@@ -27,6 +37,49 @@ typedef enum {
     LERR_BAD_OP
 } LERR_TYPE;
 
+// compiled form cache shared between a q-expression and its copies
+struct cnode_t;
+struct vm_chunk_t;
+typedef struct {
+    int refs;
+    struct cnode_t* root;     // closure tree (see closure.h)
+    struct vm_chunk_t* chunk; // bytecode (see vm.h)
+} lval_code_t;
+void cnode_del(struct cnode_t*);         // forward declarations
+void vm_chunk_del(struct vm_chunk_t*);
+
+// empty compiled form cache
+lval_code_t* lval_code_new(void) {
+    lval_code_t* code = malloc(sizeof(lval_code_t));
+    code->refs = 1;
+    code->root = NULL;
+    code->chunk = NULL;
+    return code;
+}
+
+// rope string (see rope.h)
+struct rope_t;
+void rope_release(struct rope_t*); // forward declaration
+
+// hash map table (see map.h)
+struct hmap_t;
+struct hmap_t* hmap_retain(struct hmap_t*); // forward declaration
+void hmap_release(struct hmap_t*);          // forward declaration
+
+// lazy sequence recipe (see seq.h)
+struct seq_t;
+struct seq_t* seq_retain(struct seq_t*); // forward declaration
+void seq_release(struct seq_t*);         // forward declaration
+
+// release reference to compiled form cache
+void lval_code_release(lval_code_t* code) {
+    if (code && --(code->refs) == 0) {
+        if (code->root) cnode_del(code->root);
+        if (code->chunk) vm_chunk_del(code->chunk);
+        free(code);
+    }
+}
+
 // lval
 struct lval_t {
     LVAL_TYPE type; // error or number
@@ -34,25 +87,118 @@ struct lval_t {
         long num;
         char* err;
         char* sym;
-        builtin_t builtin;
+        struct rope_t* str;
+        struct hmap_t* map;
+        struct seq_t* seq;
+        struct {
+            builtin_t builtin;   // set for builtins owning their arguments
+            builtinv_t builtinv; // set for builtins borrowing them
+            int pure;            // no side effects: calls may be folded
+            int suspends;        // may suspend the machine (see loop.h)
+        };
+        struct lval_t* tail;
+        struct {
+            long* vec; // NULL if len is 0
+            int len;
+        };
         struct {
             int count;
             struct lval_t** cell;
+            lval_code_t* code; // NULL until first shared or compiled
         };
     };
 };
 
+// maximum number of free lval cells kept by each thread
+//  NB: 0 sends every allocation straight to malloc
+#ifndef LVAL_FREELIST_MAX
+#define LVAL_FREELIST_MAX 4096
+#endif
+
+// free lval cells of current thread (linked through tail)
+//  NB: every thread recycles cells on its own, so that workers
+//      evaluating in parallel (see pool.h) rarely contend on malloc
+__thread lval_t* lval_freelist = NULL;
+__thread int lval_freecount = 0;
+
+// allocate lval cell
+lval_t* lval_alloc(void) {
+    lval_t* v = lval_freelist;
+    if (!v) return malloc(sizeof(lval_t));
+    lval_freelist = v->tail;
+    --lval_freecount;
+    return v;
+}
+
+// free lval cell
+void lval_free(lval_t* v) {
+    if (lval_freecount >= LVAL_FREELIST_MAX) {
+        free(v);
+        return;
+    }
+    v->tail = lval_freelist;
+    lval_freelist = v;
+    ++lval_freecount;
+}
+
+// give free cells of current thread back to malloc
+void lval_freelist_drain(void) {
+    while (lval_freelist) {
+        lval_t* v = lval_freelist;
+        lval_freelist = v->tail;
+        free(v);
+    }
+    lval_freecount = 0;
+}
+
 // lval number constructor
 lval_t* lval_num(long num) {
-    lval_t* v = malloc(sizeof(lval_t));
+    lval_t* v = lval_alloc();
     v->num = num;
     v->type = LVAL_NUM;
     return v;
 }
 
+// lval vector constructor
+//  NB: takes ownership of vec (malloc'd array of len numbers)
+lval_t* lval_vec(long* vec, int len) {
+    lval_t* v = lval_alloc();
+    v->type = LVAL_VEC;
+    v->vec = vec;
+    v->len = len;
+    return v;
+}
+
+// lval string constructor
+//  NB: takes ownership of a reference to str
+lval_t* lval_str(struct rope_t* str) {
+    lval_t* v = lval_alloc();
+    v->type = LVAL_STR;
+    v->str = str;
+    return v;
+}
+
+// lval map constructor
+//  NB: takes ownership of a reference to map
+lval_t* lval_map(struct hmap_t* map) {
+    lval_t* v = lval_alloc();
+    v->type = LVAL_MAP;
+    v->map = map;
+    return v;
+}
+
+// lval sequence constructor
+//  NB: takes ownership of a reference to seq
+lval_t* lval_seq(struct seq_t* seq) {
+    lval_t* v = lval_alloc();
+    v->type = LVAL_SEQ;
+    v->seq = seq;
+    return v;
+}
+
 // lval error constructor
 lval_t* lval_err(char* err) {
-    lval_t* v = malloc(sizeof(lval_t));
+    lval_t* v = lval_alloc();
     v->type = LVAL_ERR;
     v->err = malloc(strlen(err) + 1);
     strcpy(v->err, err);
@@ -61,7 +207,7 @@ lval_t* lval_err(char* err) {
 
 // lval symbol constructor
 lval_t* lval_sym(char* sym) {
-    lval_t* v = malloc(sizeof(lval_t));
+    lval_t* v = lval_alloc();
     v->type = LVAL_SYM;
     v->sym = malloc(strlen(sym) + 1);
     strcpy(v->sym, sym);
@@ -70,9 +216,53 @@ lval_t* lval_sym(char* sym) {
 
 // lval builtin constructor
 lval_t* lval_builtin(builtin_t builtin) {
-    lval_t* v = malloc(sizeof(lval_t));
+    lval_t* v = lval_alloc();
     v->type = LVAL_BUILTIN;
     v->builtin = builtin;
+    v->builtinv = NULL;
+    v->pure = 0;
+    v->suspends = 0;
+    return v;
+}
+
+// lval borrowing builtin constructor
+lval_t* lval_builtinv(builtinv_t builtinv) {
+    lval_t* v = lval_builtin(NULL);
+    v->builtinv = builtinv;
+    return v;
+}
+
+// lval pure builtin constructor
+//  NB: pure builtins only depend on their arguments and have no
+//      side effects, so calls with constant arguments may be folded
+lval_t* lval_pure_builtin(builtin_t builtin) {
+    lval_t* v = lval_builtin(builtin);
+    v->pure = 1;
+    return v;
+}
+lval_t* lval_pure_builtinv(builtinv_t builtinv) {
+    lval_t* v = lval_builtinv(builtinv);
+    v->pure = 1;
+    return v;
+}
+
+// lval suspending builtin constructor
+//  NB: when called by a machine running as a task of the event loop,
+//      suspending builtins may park the machine instead of blocking
+//      (see loop.h)
+lval_t* lval_async_builtinv(builtinv_t builtinv) {
+    lval_t* v = lval_builtinv(builtinv);
+    v->suspends = 1;
+    return v;
+}
+
+// lval tail call constructor
+//  NB: expr is a q-expression that is to be evaluated in place of
+//      the call that returned this lval
+lval_t* lval_tail(lval_t* expr) {
+    lval_t* v = lval_alloc();
+    v->type = LVAL_TAIL;
+    v->tail = expr;
     return v;
 }
 
@@ -91,34 +281,52 @@ void lval_del(lval_t* v) {
         case LVAL_BUILTIN:
             // pointer to builtin function is non-owning
             break;
+        case LVAL_VEC:
+            free(v->vec);
+            break;
+        case LVAL_STR:
+            rope_release(v->str);
+            break;
+        case LVAL_MAP:
+            hmap_release(v->map);
+            break;
+        case LVAL_SEQ:
+            seq_release(v->seq);
+            break;
+        case LVAL_TAIL:
+            lval_del(v->tail);
+            break;
         case LVAL_SEXPR: case LVAL_QEXPR:
             for (int j = 0; j < v->count; ++j) {
                 lval_del(v->cell[j]);
             }
             free(v->cell);
+            lval_code_release(v->code);
             break;
         default:
             assert(0 && "trying to deallocate malformed lval");
     }
 
-    free(v);
+    lval_free(v);
 }
 
 // lval s-expression constructor
 lval_t* lval_sexpr(void) {
-    lval_t* v = malloc(sizeof(lval_t));
+    lval_t* v = lval_alloc();
     v->type = LVAL_SEXPR;
     v->count = 0;
     v->cell = NULL;
+    v->code = NULL;
     return v;
 }
 
 // lval q-expression constructor
 lval_t* lval_qexpr(void) {
-    lval_t* v = malloc(sizeof(lval_t));
+    lval_t* v = lval_alloc();
     v->type = LVAL_QEXPR;
     v->count = 0;
     v->cell = NULL;
+    v->code = NULL;
     return v;
 }
 
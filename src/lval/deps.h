@@ -0,0 +1,214 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+#include "core.h"
+#include "expr.h"
+#include "env.h"
+#include "builtin.h"
+
+/**********************************************************/
+/*           dependencies between definitions             */
+/*--------------------------------------------------------*/
+/* NB: top level defs (as typed in the repl, or run by    */
+/*     scripts and load) are kept along with the names    */
+/*     their evaluation looked up, e.g. (def {y} (+ x 1)) */
+/*     depends on x and +. Looking up a name inside a     */
+/*     function called by the def counts too, but names   */
+/*     inside q-expressions that are only stored do not.  */
+/*     When a top level def binds names again, the defs   */
+/*     depending on them (directly or not) are run again, */
+/*     in the order they were last run, which is always   */
+/*     after the defs they depend on. Other defs are left */
+/*     alone. A def does not depend on the names it binds */
+/*     itself, so (def {n} (+ n 1)) is not run in a loop. */
+/*     Names bound by anything but a top level def (e.g.  */
+/*     loop variables) are not followed, and lookups made */
+/*     by other threads (pmap, actors) are not recorded.  */
+/**********************************************************/
+
+// evaluation of top level form (consumed) by the caller's engine
+typedef lval_t* (*deps_eval_t)(env_t*, lval_t*, const void*);
+
+// top level def
+typedef struct {
+    lval_t* form;
+    lval_t* vars;       // q-expression of names still bound by it
+    env_reads_t reads;  // names it depends on
+} deps_def_t;
+
+// defs of current thread, in the order they were last run
+__thread deps_def_t** deps_defs = NULL;
+__thread int deps_count = 0;
+__thread int deps_cap = 0;
+
+// q-expression of names bound by form (NULL if not a top level def)
+//  NB: lines are read into an s-expression holding their forms (see
+//      lval_read_src), so (def {x} 1) comes wrapped as ((def {x} 1))
+const lval_t* deps_vars(env_t* e, const lval_t* form) {
+    while (form->type == LVAL_SEXPR && form->count == 1 &&
+           form->cell[0]->type == LVAL_SEXPR)
+        form = form->cell[0];
+    if (form->type != LVAL_SEXPR || form->count < 2 ||
+        form->cell[0]->type != LVAL_SYM ||
+        form->cell[1]->type != LVAL_QEXPR)
+        return NULL;
+
+    // NB: looked up without recording it (see env_get)
+    int slot = env_slot(e, form->cell[0]->sym);
+    if (slot < 0 || e->vals[slot]->type != LVAL_BUILTIN ||
+        e->vals[slot]->builtin != &builtin_def)
+        return NULL;
+
+    const lval_t* vars = form->cell[1];
+    for (int j = 0; j < vars->count; ++j)
+        if (vars->cell[j]->type != LVAL_SYM) return NULL;
+    return vars;
+}
+
+// true if q-expression of names holds sym
+int deps_has(const lval_t* vars, const char* sym) {
+    for (int j = 0; j < vars->count; ++j)
+        if (strcmp(vars->cell[j]->sym, sym) == 0) return 1;
+    return 0;
+}
+
+// free def
+void deps_del(deps_def_t* d) {
+    lval_del(d->form);
+    lval_del(d->vars);
+    env_reads_del(&d->reads);
+    free(d);
+}
+
+// free all defs of current thread
+void deps_shutdown(void) {
+    for (int j = 0; j < deps_count; ++j) deps_del(deps_defs[j]);
+    free(deps_defs);
+    deps_defs = NULL;
+    deps_count = deps_cap = 0;
+}
+
+// keep def of form (consumed), superseding older defs of its names
+void deps_add(lval_t* form, const lval_t* vars, env_reads_t reads) {
+    // names are now bound by this def only
+    int n = 0;
+    for (int j = 0; j < deps_count; ++j) {
+        deps_def_t* d = deps_defs[j];
+        for (int k = 0; k < d->vars->count;) {
+            if (deps_has(vars, d->vars->cell[k]->sym))
+                lval_del(lval_pop(d->vars, k));
+            else
+                ++k;
+        }
+        if (d->vars->count == 0) deps_del(d);
+        else                     deps_defs[n++] = d;
+    }
+    deps_count = n;
+
+    // drop names bound by the def itself from its dependencies
+    deps_def_t* d = malloc(sizeof(deps_def_t));
+    d->form = form;
+    d->vars = lval_copy(vars);
+    d->reads = reads;
+    n = 0;
+    for (int j = 0; j < d->reads.count; ++j) {
+        if (deps_has(vars, d->reads.names[j])) free(d->reads.names[j]);
+        else d->reads.names[n++] = d->reads.names[j];
+    }
+    d->reads.count = n;
+
+    if (deps_count == deps_cap) {
+        deps_cap = deps_cap ? deps_cap * 2 : 16;
+        deps_defs = realloc(deps_defs, sizeof(deps_def_t*) * deps_cap);
+    }
+    deps_defs[deps_count++] = d;
+}
+
+// evaluate def (consumed), recording the names it looks up
+lval_t* deps_run(env_t* e, lval_t* form, deps_eval_t eval, const void* ctx) {
+    env_reads_t reads = { NULL, 0, 0 };
+    env_reads_t* outer = env_reads;
+    env_reads = &reads;
+    lval_t* ret = eval(e, lval_copy(form), ctx);
+    env_reads = outer;
+
+    if (ret->type == LVAL_ERR) {
+        env_reads_del(&reads);
+        lval_del(form);
+        return ret;
+    }
+
+    // NB: vars are read again from the form, which is kept
+    const lval_t* vars = deps_vars(e, form);
+    if (vars) {
+        deps_add(form, vars, reads);
+    } else {
+        env_reads_del(&reads);
+        lval_del(form);
+    }
+    return ret;
+}
+
+// q-expression of forms of defs depending on names (in order to run)
+//  NB: the names are the ones bound by the last def run, which is
+//      never run again
+lval_t* deps_dependents(const lval_t* vars) {
+    // mark defs reading changed names, then the names they bind
+    lval_t* changed = lval_copy(vars);
+    char* stale = calloc(deps_count ? deps_count : 1, 1);
+    int more = 1;
+    while (more) {
+        more = 0;
+        for (int j = 0; j < deps_count; ++j) {
+            deps_def_t* d = deps_defs[j];
+            if (stale[j] || j == deps_count - 1) continue;
+            for (int k = 0; k < d->reads.count; ++k) {
+                if (!deps_has(changed, d->reads.names[k])) continue;
+                stale[j] = more = 1;
+                for (int v = 0; v < d->vars->count; ++v)
+                    lval_add(changed, lval_copy(d->vars->cell[v]));
+                break;
+            }
+        }
+    }
+
+    lval_t* ret = lval_qexpr();
+    for (int j = 0; j < deps_count; ++j)
+        if (stale[j]) lval_add(ret, lval_copy(deps_defs[j]->form));
+    free(stale);
+    lval_del(changed);
+    return ret;
+}
+
+// evaluate top level form (consumed), then run again the defs that
+// depend on the names it binds
+//  NB: returns the value of the form, or the error of the first def
+//      that failed to run again (which keeps its previous value)
+lval_t* deps_eval(env_t* e, lval_t* form, deps_eval_t eval, const void* ctx) {
+    const lval_t* vars = deps_vars(e, form);
+    if (!vars || vars->count == 0) return eval(e, form, ctx);
+
+    lval_t* names = lval_copy(vars);
+    lval_t* ret = deps_run(e, form, eval, ctx);
+    if (ret->type == LVAL_ERR) {
+        lval_del(names);
+        return ret;
+    }
+
+    lval_t* stale = deps_dependents(names);
+    lval_del(names);
+    while (stale->count) {
+        lval_t* def = lval_pop(stale, 0);
+        lval_t* val = deps_run(e, def, eval, ctx);
+        if (val->type == LVAL_ERR && ret->type != LVAL_ERR) {
+            lval_del(ret);
+            ret = val;
+        } else {
+            lval_del(val);
+        }
+    }
+    lval_del(stale);
+    return ret;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "core.h"
+#include "expr.h"
 
 // environment structure
 struct env_t {
@@ -11,7 +12,7 @@ struct env_t {
 
 // constructors
 env_t* env_new() {
-    env_t* env = malloc(sizeof(env_t*));
+    env_t* env = malloc(sizeof(env_t));
     env->syms = NULL;
     env->vals = NULL;
     env->count = 0;
@@ -20,11 +21,72 @@ env_t* env_new() {
 
 // destructor
 void env_del(env_t* env) {
+    for (int j = 0; j < env->count; ++j) {
+        lval_del(env->syms[j]);
+        lval_del(env->vals[j]);
+    }
+    free(env->syms);
+    free(env->vals);
     free(env);
 }
 
-// add binding (symbol-value pair) to environment
-void env_add(env_t* env, lval_t* sym, lval_t* val) {
+// deep copy of environment (see lval_clone)
+env_t* env_clone(const env_t* env) {
+    env_t* ret = env_new();
+    ret->count = env->count;
+    ret->syms = malloc(sizeof(lval_t*) * (env->count ? env->count : 1));
+    ret->vals = malloc(sizeof(lval_t*) * (env->count ? env->count : 1));
+    for (int j = 0; j < env->count; ++j) {
+        ret->syms[j] = lval_clone(env->syms[j]);
+        ret->vals[j] = lval_clone(env->vals[j]);
+    }
+    return ret;
+}
+
+// names looked up by an evaluation (see deps.h)
+typedef struct {
+    char** names;
+    int count;
+    int cap;
+} env_reads_t;
+
+// names looked up by current thread are added here (if not NULL)
+__thread env_reads_t* env_reads = NULL;
+
+// add name to names looked up (once)
+void env_read(const char* sym) {
+    env_reads_t* r = env_reads;
+    for (int j = 0; j < r->count; ++j)
+        if (strcmp(r->names[j], sym) == 0) return;
+
+    if (r->count == r->cap) {
+        r->cap = r->cap ? r->cap * 2 : 8;
+        r->names = realloc(r->names, sizeof(char*) * r->cap);
+    }
+    r->names[r->count] = malloc(strlen(sym) + 1);
+    strcpy(r->names[r->count++], sym);
+}
+
+// free names looked up
+void env_reads_del(env_reads_t* r) {
+    for (int j = 0; j < r->count; ++j) free(r->names[j]);
+    free(r->names);
+    r->names = NULL;
+    r->count = r->cap = 0;
+}
+
+// index of binding of given symbol name (-1 if not bound)
+int env_slot(env_t* e, const char* sym) {
+    for (int j = 0; j < e->count; ++j) {
+        if (strcmp(e->syms[j]->sym, sym) == 0)
+            return j;
+    }
+
+    return -1;
+}
+
+// add binding of symbol known not to be bound yet
+void env_push(env_t* env, lval_t* sym, lval_t* val) {
     // allocate fields if non existent
     if (!env->syms)
         env->syms = malloc(sizeof(lval_t**));
@@ -41,15 +103,36 @@ void env_add(env_t* env, lval_t* sym, lval_t* val) {
     env->vals[env->count - 1] = val;
 }
 
-// find value associated with given symbol and return its value
+// add binding (symbol-value pair) to environment
+//  NB: rebinding a symbol replaces its value in place, so the
+//      slot of a binding never changes once it is created
+void env_add(env_t* env, lval_t* sym, lval_t* val) {
+    // replace existing binding
+    int slot = env_slot(env, sym->sym);
+    if (slot >= 0) {
+        lval_del(env->vals[slot]);
+        env->vals[slot] = val;
+        lval_del(sym);
+        return;
+    }
+
+    env_push(env, sym, val);
+}
+
+// find value bound to given symbol name without copying it
+//  NB: returns NULL if no variable was found
+lval_t* env_get(env_t* e, const char* sym) {
+    if (env_reads) env_read(sym);
+    int slot = env_slot(e, sym);
+    return slot >= 0 ? e->vals[slot] : NULL;
+}
+
+// find value associated with given symbol and return a copy of it
 lval_t* env_find(env_t* e, lval_t* s) {
     assert(s->type == LVAL_SYM && "Trying to evaluate non-symbol as variable!");
 
-    for (int j = 0; j < e->count; ++j) {
-        if (strcmp(e->syms[j]->sym, s->sym) == 0)
-            return e->vals[j];
-    }
+    lval_t* val = env_get(e, s->sym);
 
-    // return if no variable was found
-    return lval_nil();
+    // return nil if no variable was found
+    return val ? lval_copy(val) : lval_nil();
 }
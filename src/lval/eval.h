@@ -23,16 +23,57 @@ void alba_print_ast(mpc_ast_t* ast, int depth) {
     }
 }
 
+// trampoline: run pending tail evaluations until a value is produced
+//  NB: tail evaluations go through the compiled form cached on their
+//      q-expression, so that evaluating the same one again reuses it
+lval_t* closure_eval(env_t*, lval_t*); // forward declarations
+int machine_charge(void);
+lval_t* machine_starved(void);
+lval_t* lval_force(env_t* e, lval_t* v) {
+    while (v->type == LVAL_TAIL) {
+        lval_t* expr = v->tail;
+        v->tail = NULL;
+        lval_free(v);
+        v = closure_eval(e, expr);
+    }
+    return v;
+}
+
+// call callable with s-expression of (already evaluated) arguments
+//  NB: may return a tail call, see lval_force
+lval_t* lval_call(env_t* e, lval_t* f, lval_t* args) {
+    // ensure it is actually a callable
+    //  TODO: only checks and works with builtins for now
+    if (f->type != LVAL_BUILTIN) {
+        lval_del(f); lval_del(args);
+        return lval_err("sexpr needs to have a callable as its first element");
+    }
+
+    // evaluate expression using callable
+    //  NB: only builtins work for now
+    lval_t* ret = f->builtinv ? f->builtinv(e, args->count, args->cell) :
+                                f->builtin(e, args);
+    if (f->builtinv) lval_del(args);
+    lval_del(f);
+    return ret;
+}
+
 // evaluate s-expression
 lval_t* lval_eval(env_t*, lval_t*); // forward declaration
+extern long par_min_cost;           // forward declaration
+int par_eval_args(env_t*, lval_t*); // forward declaration
 lval_t* lval_eval_sexpr(env_t* e, lval_t* v) {
     // evaluate children (apart from symbol)
+    //  NB: expensive pure arguments may be evaluated in parallel
+    //      beforehand (see par.h)
+    int done = par_min_cost > 0 && par_eval_args(e, v);
     for (int j = 0; j < v->count; ++j) {
-        v->cell[j] = lval_eval(e, v->cell[j]);
-    }
+        if (!done) v->cell[j] = lval_eval(e, v->cell[j]);
 
-    // propagate errors
-    for (int j = 0; j < v->count; ++j) {
+        // propagate errors right away, releasing the evaluated
+        // and the still unevaluated children together
+        //  NB: an error always aborts the evaluation of the whole
+        //      form, so nothing after it needs to be evaluated
         if (v->cell[j]->type == LVAL_ERR)
             return lval_take(v, j);
     }
@@ -43,22 +84,15 @@ lval_t* lval_eval_sexpr(env_t* e, lval_t* v) {
     // 1 element: take it (eliminating parentheses)
     if (v->count == 1) return lval_take(v, 0);
 
-    // 2 or more: pop first as symbol
-    lval_t* sym = lval_pop(v, 0);
-
-    // cleanup before returning error
-    #define errclean() lval_del(sym); lval_del(v);
-
-    // ensure it is actually a callable
-    //  TODO: only checks and works with builtins for now
-    if (sym->type != LVAL_BUILTIN) {
-        errclean();
-        return lval_err("sexpr needs to have a callable as its first element");
+    // 2 or more: call first element
+    //  NB: borrowing builtins read their arguments in place
+    lval_t* f = v->cell[0];
+    if (f->type == LVAL_BUILTIN && f->builtinv) {
+        lval_t* ret = f->builtinv(e, v->count - 1, &v->cell[1]);
+        lval_del(v);
+        return ret;
     }
-
-    // evaluate expression using callable
-    //  NB: only builtins work for now
-    return sym->builtin(e, v);
+    return lval_call(e, lval_pop(v, 0), v);
 }
 
 // evaluate lval
@@ -67,15 +101,64 @@ lval_t* lval_eval(env_t* e, lval_t* v) {
 
     // atomic expressions
     switch (v->type) {
-        case LVAL_NUM: case LVAL_ERR: case LVAL_QEXPR:
+        case LVAL_NUM: case LVAL_ERR: case LVAL_QEXPR: case LVAL_BUILTIN:
+        case LVAL_VEC: case LVAL_STR: case LVAL_MAP: case LVAL_SEQ:
             return v;
-        case LVAL_SYM:
-            // return associated environment value
+        case LVAL_SYM: {
+            // return copy of associated environment value
             // (or nil if not present)
-            return env_find(e, v);
+            lval_t* val = env_find(e, v);
+            lval_del(v);
+            return val;
+        }
         case LVAL_SEXPR:
-            return lval_eval_sexpr(e, v);
+            // calls are charged to the budget of the evaluation, if any
+            if (!machine_charge()) {
+                lval_del(v);
+                return machine_starved();
+            }
+            return lval_force(e, lval_eval_sexpr(e, v));
+        case LVAL_TAIL:
+            return lval_force(e, v);
         default:
             assert(0 && "trying to evaluate lval of unknown type");
     }
 }
+
+// true if lval counts as true in conditions
+//  NB: only 0 and empty lists count as false
+int lval_is_true(const lval_t* v) {
+    switch (v->type) {
+        case LVAL_NUM:                    return v->num != 0;
+        case LVAL_SEXPR: case LVAL_QEXPR: return v->count != 0;
+        default:                          return 1;
+    }
+}
+
+// apply function to arguments (consumed) and return result
+//  NB: f is either a builtin or a q-expression whose elements are
+//      evaluated and then called with the arguments appended,
+//      e.g. {+ 1} applied to 2 is (+ 1 2). Arguments are values and
+//      are not evaluated again
+lval_t* lval_apply(env_t* e, const lval_t* f, int argc, lval_t** args) {
+    lval_t* call = lval_sexpr();
+
+    if (f->type == LVAL_QEXPR && f->count > 0) {
+        for (int j = 0; j < f->count; ++j) {
+            lval_t* val = lval_eval(e, lval_copy(f->cell[j]));
+            if (val->type == LVAL_ERR) {
+                for (int k = 0; k < argc; ++k) lval_del(args[k]);
+                lval_del(call);
+                return val;
+            }
+            lval_add(call, val);
+        }
+    } else {
+        lval_add(call, lval_copy(f));
+    }
+
+    for (int j = 0; j < argc; ++j)
+        lval_add(call, args[j]);
+
+    return lval_force(e, lval_call(e, lval_pop(call, 0), call));
+}
@@ -1,11 +1,20 @@
 #pragma once
 
 #include "core.h"
+#include "rope.h"
+
+// detach expr from compiled form cache it shares with its copies
+//  NB: needs to be called before mutating the cells of expr
+void lval_detach(lval_t* expr) {
+    lval_code_release(expr->code);
+    expr->code = NULL;
+}
 
 // add element to lval containing expr
 void lval_add(lval_t* expr, lval_t* toAdd) {
     assert(expr && "trying to add lval to NULL expr");
 
+    lval_detach(expr);
     ++(expr->count);
     expr->cell = realloc(expr->cell, sizeof(lval_t*) * expr->count);
     expr->cell[expr->count - 1] = toAdd;
@@ -17,6 +26,8 @@ lval_t* lval_pop(lval_t* expr, int pos) {
     if (expr->count == 0)
         return NULL;
 
+    lval_detach(expr);
+
     // take
     lval_t* ret = expr->cell[pos];
 
@@ -37,3 +48,100 @@ lval_t* lval_take(lval_t* expr, int pos) {
     lval_del(expr);
     return ret;
 }
+
+// deep copy lval
+lval_t* lval_copy(const lval_t* v) {
+    assert(v && "trying to copy NULL lval");
+
+    lval_t* ret = lval_alloc();
+    ret->type = v->type;
+
+    switch (v->type) {
+        case LVAL_NUM:
+            ret->num = v->num;
+            break;
+        case LVAL_ERR:
+            ret->err = malloc(strlen(v->err) + 1);
+            strcpy(ret->err, v->err);
+            break;
+        case LVAL_SYM:
+            ret->sym = malloc(strlen(v->sym) + 1);
+            strcpy(ret->sym, v->sym);
+            break;
+        case LVAL_BUILTIN:
+            ret->builtin = v->builtin;
+            ret->builtinv = v->builtinv;
+            ret->pure = v->pure;
+            ret->suspends = v->suspends;
+            break;
+        case LVAL_VEC:
+            ret->len = v->len;
+            ret->vec = v->len ? malloc(sizeof(long) * v->len) : NULL;
+            if (v->len) memcpy(ret->vec, v->vec, sizeof(long) * v->len);
+            break;
+        case LVAL_STR:
+            // strings are immutable: share them
+            ret->str = rope_retain(v->str);
+            break;
+        case LVAL_MAP:
+            // maps are copied on write: share them
+            ret->map = hmap_retain(v->map);
+            break;
+        case LVAL_SEQ:
+            // sequences are immutable recipes: share them
+            ret->seq = seq_retain(v->seq);
+            break;
+        case LVAL_TAIL:
+            ret->tail = lval_copy(v->tail);
+            break;
+        case LVAL_SEXPR: case LVAL_QEXPR:
+            ret->count = v->count;
+            ret->cell = v->count ? malloc(sizeof(lval_t*) * v->count) : NULL;
+            for (int j = 0; j < v->count; ++j)
+                ret->cell[j] = lval_copy(v->cell[j]);
+            ret->code = NULL;
+            // q-expressions share their compiled form with their copies
+            if (v->type == LVAL_QEXPR) {
+                if (!v->code) {
+                    ((lval_t*) v)->code = lval_code_new();
+                }
+                ret->code = v->code;
+                ++(ret->code->refs);
+            }
+            break;
+        default:
+            assert(0 && "trying to copy lval of unknown type");
+    }
+
+    return ret;
+}
+
+// deep copy lval, sharing nothing but (immutable) strings
+//  NB: unlike lval_copy, does not touch v and the copy does not share
+//      compiled forms, maps or sequences with it: the copy can be
+//      handed to another thread while v is still being read
+struct hmap_t* hmap_clone(const struct hmap_t*,
+                          lval_t* (*)(const lval_t*)); // forward declaration
+struct seq_t* seq_clone(const struct seq_t*);          // forward declaration
+lval_t* lval_clone(const lval_t* v) {
+    switch (v->type) {
+        case LVAL_SEXPR: case LVAL_QEXPR: {
+            lval_t* ret = lval_alloc();
+            ret->type = v->type;
+            ret->count = v->count;
+            ret->cell = v->count ? malloc(sizeof(lval_t*) * v->count) : NULL;
+            for (int j = 0; j < v->count; ++j)
+                ret->cell[j] = lval_clone(v->cell[j]);
+            ret->code = NULL;
+            return ret;
+        }
+        case LVAL_MAP:
+            return lval_map(hmap_clone(v->map, &lval_clone));
+        case LVAL_SEQ:
+            return lval_seq(seq_clone(v->seq));
+        case LVAL_TAIL:
+            return lval_tail(lval_clone(v->tail));
+        default:
+            return lval_copy(v);
+    }
+}
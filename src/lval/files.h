@@ -0,0 +1,300 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+/**********************************************************/
+/*                   bulk file loading                    */
+/*--------------------------------------------------------*/
+/* NB: reads whole files into memory at once, so that the */
+/*     parser gets complete buffers. Every file gets a    */
+/*     buffer sized to it and is read in large chunks.    */
+/*     On Linux all reads are queued on an io_uring, so   */
+/*     the kernel works on many files at a time. Where    */
+/*     io_uring is not available (or with ALBA_NO_URING)  */
+/*     files are read one after the other with pread.     */
+/*     Files that are not regular (e.g. pipes) are read   */
+/*     until their end with plain reads.                  */
+/**********************************************************/
+
+// bytes read from a file by a single request
+#ifndef FILES_CHUNK
+#define FILES_CHUNK (1L << 20)
+#endif
+
+// maximum number of requests in flight
+#ifndef FILES_QUEUE
+#define FILES_QUEUE 64
+#endif
+
+// io_uring is used if possible
+#if defined(__linux__) && defined(__NR_io_uring_setup) && !defined(ALBA_NO_URING)
+#define FILES_URING
+#endif
+
+// contents of a file
+typedef struct {
+    char* data; // NUL terminated (NULL on error)
+    long len;
+    int err;    // errno of failure (0 if none)
+    // reading
+    int fd;
+    long size;
+    int inFlight;
+} files_buf_t;
+
+// open file and allocate buffer for it
+//  NB: returns 0 if the buffer still needs to be filled
+int files_open(const char* path, files_buf_t* b) {
+    memset(b, 0, sizeof(files_buf_t));
+    b->fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (b->fd < 0 || fstat(b->fd, &st) < 0) {
+        b->err = errno;
+        return 1;
+    }
+
+    // not a regular file: read until end
+    if (!S_ISREG(st.st_mode)) {
+        long cap = FILES_CHUNK;
+        b->data = malloc(cap + 1);
+        long got;
+        while ((got = read(b->fd, b->data + b->len, cap - b->len)) > 0) {
+            b->len += got;
+            if (b->len == cap) {
+                cap *= 2;
+                b->data = realloc(b->data, cap + 1);
+            }
+        }
+        if (got < 0) b->err = errno;
+        return 1;
+    }
+
+    b->size = st.st_size;
+    b->data = malloc(b->size + 1);
+    return b->size == 0;
+}
+
+// release file, leaving buffer (or error)
+void files_close(files_buf_t* b) {
+    if (b->fd >= 0) close(b->fd);
+    b->fd = -1;
+    if (b->err) {
+        free(b->data);
+        b->data = NULL;
+        b->len = 0;
+    } else {
+        b->data[b->len] = '\0';
+    }
+}
+
+/****************/
+/* pread chunks */
+/****************/
+
+// fill buffer with pread
+void files_pread(files_buf_t* b) {
+    while (b->len < b->size) {
+        long n = b->size - b->len < FILES_CHUNK ? b->size - b->len : FILES_CHUNK;
+        long got = pread(b->fd, b->data + b->len, n, b->len);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) b->err = errno;
+        if (got <= 0) break; // error, or file shrank
+        b->len += got;
+    }
+}
+
+/************/
+/* io_uring */
+/************/
+
+#ifdef FILES_URING
+
+// submission and completion rings
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    struct io_uring_sqe* sqes;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+    // mappings
+    void* sq;
+    size_t sqSize;
+    void* cq;
+    size_t cqSize;
+    size_t sqesSize;
+} files_ring_t;
+
+// set up ring (returns 0 on failure)
+int files_ring_init(files_ring_t* r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(files_ring_t));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) return 0;
+    r->entries = p.sq_entries;
+
+    // map rings (a single mapping if the kernel allows it)
+    r->sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cqSize > r->sqSize) r->sqSize = r->cqSize;
+        r->cqSize = 0;
+    }
+    r->sq = mmap(NULL, r->sqSize, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq = r->cqSize ?
+        mmap(NULL, r->cqSize, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING) : r->sq;
+    r->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqesSize, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sq == MAP_FAILED || r->cq == MAP_FAILED || r->sqes == MAP_FAILED) {
+        if (r->sq != MAP_FAILED) munmap(r->sq, r->sqSize);
+        if (r->cqSize && r->cq != MAP_FAILED) munmap(r->cq, r->cqSize);
+        if (r->sqes != MAP_FAILED) munmap(r->sqes, r->sqesSize);
+        close(r->fd);
+        return 0;
+    }
+
+    char* sq = r->sq;
+    char* cq = r->cq;
+    r->sqHead  = (unsigned*) (sq + p.sq_off.head);
+    r->sqTail  = (unsigned*) (sq + p.sq_off.tail);
+    r->sqMask  = (unsigned*) (sq + p.sq_off.ring_mask);
+    r->sqArray = (unsigned*) (sq + p.sq_off.array);
+    r->cqHead  = (unsigned*) (cq + p.cq_off.head);
+    r->cqTail  = (unsigned*) (cq + p.cq_off.tail);
+    r->cqMask  = (unsigned*) (cq + p.cq_off.ring_mask);
+    r->cqes    = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+    return 1;
+}
+
+// tear down ring
+void files_ring_del(files_ring_t* r) {
+    munmap(r->sqes, r->sqesSize);
+    if (r->cqSize) munmap(r->cq, r->cqSize);
+    munmap(r->sq, r->sqSize);
+    close(r->fd);
+}
+
+// queue read of next chunk of buffer j
+void files_ring_read(files_ring_t* r, files_buf_t* b, int j) {
+    unsigned tail = *r->sqTail;
+    unsigned idx = tail & *r->sqMask;
+    struct io_uring_sqe* sqe = &r->sqes[idx];
+    long n = b->size - b->len < FILES_CHUNK ? b->size - b->len : FILES_CHUNK;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = b->fd;
+    sqe->addr = (unsigned long) (b->data + b->len);
+    sqe->len = n;
+    sqe->off = b->len;
+    sqe->user_data = j;
+    r->sqArray[idx] = idx;
+    __atomic_store_n(r->sqTail, tail + 1, __ATOMIC_RELEASE);
+    b->inFlight = 1;
+}
+
+// fill buffers through ring, keeping up to entries reads in flight
+//  NB: returns 0 (leaving buffers as they are) if the kernel does not
+//      support the reads, so that the caller can fall back to pread
+int files_ring_fill(files_ring_t* r, files_buf_t* bufs, int n) {
+    int next = 0;      // next buffer not started yet
+    int inFlight = 0;
+    int unsubmitted = 0; // reads queued but not taken by the kernel yet
+
+    while (1) {
+        // queue reads for buffers that are not full yet
+        while (inFlight < (int) r->entries && next < n) {
+            files_buf_t* b = &bufs[next];
+            if (b->fd >= 0 && !b->err && b->len < b->size && !b->inFlight) {
+                files_ring_read(r, b, next);
+                ++unsubmitted; ++inFlight;
+            }
+            ++next;
+        }
+        if (inFlight == 0) return 1;
+
+        // submit and wait for at least one completion
+        //  NB: reads the kernel did not take (interrupted or partial
+        //      submission) are submitted again on the next round
+        long taken = syscall(__NR_io_uring_enter, r->fd, unsubmitted, 1,
+                             IORING_ENTER_GETEVENTS, NULL, 0);
+        if (taken < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        unsubmitted -= taken;
+
+        // reap completions
+        unsigned head = *r->cqHead;
+        unsigned tail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            struct io_uring_cqe* cqe = &r->cqes[head & *r->cqMask];
+            files_buf_t* b = &bufs[cqe->user_data];
+            b->inFlight = 0;
+            --inFlight;
+
+            if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+                __atomic_store_n(r->cqHead, head + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+            if (cqe->res < 0) b->err = -cqe->res;
+            else if (cqe->res == 0) b->size = b->len; // file shrank
+            else b->len += cqe->res;
+
+            // more to read: start over from this buffer
+            if (!b->err && b->len < b->size && cqe->user_data < (unsigned) next)
+                next = cqe->user_data;
+        }
+        __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+    }
+}
+
+#endif
+
+/***********/
+/* loading */
+/***********/
+
+// read n files whole (the buffers are to be freed by the caller)
+//  NB: a file that cannot be read gets NULL data and its errno
+files_buf_t* files_read_all(const char* const* paths, int n) {
+    files_buf_t* bufs = malloc(sizeof(files_buf_t) * (n > 0 ? n : 1));
+    for (int j = 0; j < n; ++j)
+        if (files_open(paths[j], &bufs[j])) files_close(&bufs[j]);
+
+    int done = 0;
+#ifdef FILES_URING
+    files_ring_t ring;
+    if (files_ring_init(&ring, FILES_QUEUE)) {
+        done = files_ring_fill(&ring, bufs, n);
+        files_ring_del(&ring);
+    }
+#endif
+
+    for (int j = 0; j < n; ++j) {
+        if (bufs[j].fd < 0) continue;
+        if (!done) files_pread(&bufs[j]);
+        files_close(&bufs[j]);
+    }
+    return bufs;
+}
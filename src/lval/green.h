@@ -0,0 +1,193 @@
+#pragma once
+
+#include "core.h"
+#include "expr.h"
+#include "machine.h"
+#include "loop.h"
+#include "lassert.h"
+
+/**********************************************************/
+/*                green threads and channels              */
+/*--------------------------------------------------------*/
+/* NB: green threads are the tasks of the event loop (see */
+/*     loop.h): spawn and join are the same builtins as   */
+/*     async and await. Every thread has its own machine, */
+/*     so switching threads is just suspending a machine  */
+/*     and resuming another, and no C stack is needed.    */
+/*     Threads switch when they yield, or when they wait  */
+/*     on a channel, a descriptor or another thread.      */
+/*     Channels pass values between threads in order.     */
+/*     Sending to a full channel (or to one without a     */
+/*     buffer, while no thread is receiving) waits for a  */
+/*     receiver, and receiving from an empty channel      */
+/*     waits for a sender. Outside of threads, waiting    */
+/*     runs the threads until the operation can be done.  */
+/**********************************************************/
+
+// channel
+typedef struct {
+    io_queue_t vals;    // buffered values
+    int size;           // maximum number of buffered values
+    io_queue_t waiters; // threads waiting to send, or to receive
+} green_chan_t;
+
+// channels of current thread (by id)
+__thread green_chan_t** green_chans = NULL;
+__thread int green_count = 0;
+__thread int green_cap = 0;
+
+// channel with given id (NULL if none)
+green_chan_t* green_chan(const lval_t* id) {
+    if (id->type != LVAL_NUM || id->num < 0 || id->num >= green_count)
+        return NULL;
+    return green_chans[id->num];
+}
+
+// free all channels
+void green_shutdown(void) {
+    for (int j = 0; j < green_count; ++j) {
+        green_chan_t* c = green_chans[j];
+        lval_t* v;
+        while ((v = io_queue_pop(&c->vals))) lval_del(v);
+        free(c->vals.items);
+        free(c->waiters.items);
+        free(c);
+    }
+    free(green_chans);
+    green_chans = NULL;
+    green_count = green_cap = 0;
+}
+
+// first waiting thread of channel doing op (NULL if none)
+io_task_t* green_waiter(green_chan_t* c, io_op_t op) {
+    if (c->waiters.count == 0) return NULL;
+    io_task_t* t = c->waiters.items[c->waiters.head];
+    return t->op == op ? io_queue_pop(&c->waiters) : NULL;
+}
+
+// send val (consumed) if it can be done right away (returns 0 if not)
+int green_try_send(io_loop_t* l, green_chan_t* c, lval_t* val) {
+    io_task_t* r = green_waiter(c, IO_RECV);
+    if (r) {
+        io_complete(l, r, val);
+        return 1;
+    }
+    if (c->vals.count < c->size) {
+        io_queue_push(&c->vals, val);
+        return 1;
+    }
+    return 0;
+}
+
+// receive value if it can be done right away (NULL if not)
+lval_t* green_try_recv(io_loop_t* l, green_chan_t* c) {
+    lval_t* val = io_queue_pop(&c->vals);
+
+    // let first waiting sender go on
+    io_task_t* s = green_waiter(c, IO_SEND);
+    if (s) {
+        lval_t* sent = s->sent;
+        s->sent = NULL;
+        if (val) io_queue_push(&c->vals, sent);
+        else     val = sent;
+        io_complete(l, s, lval_sexpr());
+    }
+    return val;
+}
+
+/************/
+/* builtins */
+/************/
+
+// yield (let other threads run, then return value)
+lval_t* builtin_yield(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "yield");
+
+    // inside thread: go to the back of the queue (see io_step)
+    if (machine_current) {
+        io_task_t* self = machine_current->owner;
+        self->op = IO_YIELD;
+        self->sent = lval_copy(argv[0]);
+        io_push_ready(io_get(), self);
+        machine_suspend(machine_current);
+        return lval_sexpr();
+    }
+
+    // outside thread: run ready threads once
+    io_loop_t* l = io_get();
+    if (l->ready.count) io_step(l);
+    return lval_copy(argv[0]);
+}
+
+// chan (new channel buffering up to n values)
+lval_t* builtin_chan(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "chan");
+    LASSERTV(argv[0]->type == LVAL_NUM && argv[0]->num >= 0,
+             "'chan' needs to be passed a buffer size");
+
+    if (green_count == green_cap) {
+        green_cap = green_cap ? green_cap * 2 : 16;
+        green_chans = realloc(green_chans, sizeof(green_chan_t*) * green_cap);
+    }
+    green_chan_t* c = calloc(1, sizeof(green_chan_t));
+    c->size = argv[0]->num;
+    green_chans[green_count] = c;
+    return lval_num(green_count++);
+}
+
+// send (value to channel)
+lval_t* builtin_send(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 2, 2, "send");
+    green_chan_t* c = green_chan(argv[0]);
+    LASSERTV(c, "'send' needs to be passed a channel first");
+
+    io_loop_t* l = io_get();
+    lval_t* val = lval_copy(argv[1]);
+    if (green_try_send(l, c, val)) return lval_sexpr();
+
+    // inside thread: wait for a receiver (see green_try_recv)
+    if (machine_current) {
+        io_task_t* self = machine_current->owner;
+        self->op = IO_SEND;
+        self->sent = val;
+        io_queue_push(&c->waiters, self);
+        machine_suspend(machine_current);
+        return lval_sexpr();
+    }
+
+    // outside thread: run threads until a receiver shows up
+    do {
+        if (!io_step(l)) {
+            lval_del(val);
+            return lval_err("'send' would wait forever!");
+        }
+    } while (!green_try_send(l, c, val));
+    return lval_sexpr();
+}
+
+// recv (next value of channel)
+lval_t* builtin_recv(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "recv");
+    green_chan_t* c = green_chan(argv[0]);
+    LASSERTV(c, "'recv' needs to be passed a channel");
+
+    io_loop_t* l = io_get();
+    lval_t* val = green_try_recv(l, c);
+    if (val) return val;
+
+    // inside thread: wait for a sender (see green_try_send)
+    if (machine_current) {
+        io_task_t* self = machine_current->owner;
+        self->op = IO_RECV;
+        io_queue_push(&c->waiters, self);
+        machine_suspend(machine_current);
+        return lval_sexpr();
+    }
+
+    // outside thread: run threads until a sender shows up
+    while (!(val = green_try_recv(l, c))) {
+        if (!io_step(l))
+            return lval_err("'recv' would wait forever!");
+    }
+    return val;
+}
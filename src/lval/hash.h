@@ -0,0 +1,114 @@
+#pragma once
+
+#include <string.h>
+
+#include "core.h"
+#include "rope.h"
+
+/**********************************************************/
+/*              structural hashing and equality           */
+/*--------------------------------------------------------*/
+/* NB: two lvals are equal if they have the same type and */
+/*     the same contents (recursively for expressions),   */
+/*     builtins are equal if they run the same function   */
+/*     and sequences are only equal to themselves.        */
+/*     Equal lvals always have the same hash.             */
+/**********************************************************/
+
+// forward declarations (see map.h)
+struct hmap_t;
+unsigned long hmap_hash(const struct hmap_t*);
+int hmap_eq(const struct hmap_t*, const struct hmap_t*);
+
+// scramble bits of x (splitmix64 finalizer)
+unsigned long hash_mix(unsigned long x) {
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9UL;
+    x ^= x >> 27; x *= 0x94d049bb133111ebUL;
+    x ^= x >> 31;
+    return x;
+}
+
+// FNV-1a over len bytes, continuing from h
+unsigned long hash_bytes(unsigned long h, const char* s, long len) {
+    for (long j = 0; j < len; ++j) {
+        h ^= (unsigned char) s[j];
+        h *= 0x100000001b3UL;
+    }
+    return h;
+}
+
+// hash_bytes over the leaves of a rope
+void hash_rope_leaf(const char* s, long len, void* ctx) {
+    unsigned long* h = ctx;
+    *h = hash_bytes(*h, s, len);
+}
+
+// structural hash of lval
+unsigned long lval_hash(const lval_t* v) {
+    unsigned long h = 0xcbf29ce484222325UL ^ v->type;
+
+    switch (v->type) {
+        case LVAL_NUM:
+            return hash_mix(h ^ (unsigned long) v->num);
+        case LVAL_ERR:
+            return hash_bytes(h, v->err, strlen(v->err));
+        case LVAL_SYM:
+            return hash_bytes(h, v->sym, strlen(v->sym));
+        case LVAL_STR:
+            rope_each(v->str, &hash_rope_leaf, &h);
+            return h;
+        case LVAL_BUILTIN:
+            return hash_mix(h ^ (unsigned long) (v->builtinv ?
+                (void*) v->builtinv : (void*) v->builtin));
+        case LVAL_VEC:
+            for (int j = 0; j < v->len; ++j)
+                h = hash_mix(h + (unsigned long) v->vec[j]);
+            return h;
+        case LVAL_SEXPR: case LVAL_QEXPR:
+            for (int j = 0; j < v->count; ++j)
+                h = hash_mix(h + lval_hash(v->cell[j]));
+            return h;
+        case LVAL_MAP:
+            return hash_mix(h ^ hmap_hash(v->map));
+        case LVAL_SEQ:
+            // sequences are only equal to themselves
+            return hash_mix(h ^ (unsigned long) v->seq);
+        default:
+            assert(0 && "trying to hash lval of unknown type");
+            return h;
+    }
+}
+
+// true if a and b are structurally equal
+int lval_eq(const lval_t* a, const lval_t* b) {
+    if (a->type != b->type) return 0;
+
+    switch (a->type) {
+        case LVAL_NUM:
+            return a->num == b->num;
+        case LVAL_ERR:
+            return strcmp(a->err, b->err) == 0;
+        case LVAL_SYM:
+            return strcmp(a->sym, b->sym) == 0;
+        case LVAL_STR:
+            return rope_eq(a->str, b->str);
+        case LVAL_BUILTIN:
+            return a->builtin == b->builtin && a->builtinv == b->builtinv;
+        case LVAL_VEC:
+            return a->len == b->len &&
+                   (a->len == 0 ||
+                    memcmp(a->vec, b->vec, sizeof(long) * a->len) == 0);
+        case LVAL_SEXPR: case LVAL_QEXPR:
+            if (a->count != b->count) return 0;
+            for (int j = 0; j < a->count; ++j)
+                if (!lval_eq(a->cell[j], b->cell[j])) return 0;
+            return 1;
+        case LVAL_MAP:
+            return hmap_eq(a->map, b->map);
+        case LVAL_SEQ:
+            return a->seq == b->seq;
+        default:
+            assert(0 && "trying to compare lvals of unknown type");
+            return 0;
+    }
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "core.h"
+#include "expr.h"
+#include "env.h"
+#include "rope.h"
+#include "module.h"
+#include "lassert.h"
+
+/**********************************************************/
+/*                   environment images                   */
+/*--------------------------------------------------------*/
+/* NB: (save-image "file") writes the bindings of the     */
+/*     environment to a file, which --image loads back    */
+/*     into the global environment of a later run, e.g.   */
+/*     after a prelude was run once. Images hold no       */
+/*     pointers: values are written like module caches    */
+/*     (see module.h), builtins by the name they were     */
+/*     registered under on startup (see image_register),  */
+/*     and are rebuilt from a mapping of the file in a    */
+/*     single pass. Names still bound to the builtin      */
+/*     registered under them are not saved, as every run  */
+/*     binds them anyway; rebound ones are, e.g. after    */
+/*     (def {+} -), + is saved as the builtin named -.    */
+/*     Images are written to a temporary file renamed     */
+/*     into place, so a failed save keeps the old image.  */
+/*     Bindings holding sequences (which may hold running */
+/*     state) are skipped. Compiled forms are not saved   */
+/*     either, they are compiled again on first use.      */
+/**********************************************************/
+
+// version of the image format (bump on any change)
+#define IMAGE_VERSION 2
+
+// builtins as registered on startup, naming them in images
+//  NB: only written before other threads start (see image_register)
+env_t* image_builtins = NULL;
+
+// keep builtins bound in environment as the registered ones
+void image_register(const env_t* e) {
+    if (image_builtins) env_del(image_builtins);
+    image_builtins = env_clone(e);
+}
+
+// free registered builtins
+void image_shutdown(void) {
+    if (image_builtins) env_del(image_builtins);
+    image_builtins = NULL;
+}
+
+// true if value is the builtin registered under name
+int image_is_registered(const char* sym, const lval_t* v) {
+    int slot = image_builtins ? env_slot(image_builtins, sym) : -1;
+    if (slot < 0 || v->type != LVAL_BUILTIN) return 0;
+    const lval_t* b = image_builtins->vals[slot];
+    return b->builtin == v->builtin && b->builtinv == v->builtinv;
+}
+
+// header of image file
+typedef struct {
+    char magic[8];     // "ALBAI" padded with NULs
+    uint32_t version;  // IMAGE_VERSION and MODULE_VERSION
+    uint32_t wordSize; // sizeof(long)
+    uint64_t count;    // number of bindings following the header
+} image_header_t;
+
+// write bindings of environment to file (returns errno of failure, or 0)
+//  NB: also returns the number of bindings written in count
+int image_save(env_t* e, const char* path, int* count) {
+    image_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "ALBAI", 5);
+    h.version = IMAGE_VERSION << 16 | MODULE_VERSION;
+    h.wordSize = sizeof(long);
+
+    // bindings, skipping names bound to their registered builtin
+    module_out_t o = { NULL, 0, 0, image_builtins };
+    module_put(&o, &h, sizeof(h));
+    for (int j = 0; j < e->count; ++j) {
+        const lval_t* val = e->vals[j];
+        if (image_is_registered(e->syms[j]->sym, val)) continue;
+        if (!module_can_put(&o, val)) continue;
+        module_put_form(&o, e->syms[j]);
+        module_put_form(&o, val);
+        ++h.count;
+    }
+    memcpy(o.data, &h, sizeof(h));
+
+    int err = module_write_file(path, o.data, o.len);
+    free(o.data);
+    *count = h.count;
+    return err;
+}
+
+// bind names of image file in environment
+//  NB: returns NULL on success, or an error (bindings read before a
+//      malformed one are kept)
+lval_t* image_load(env_t* e, const char* path) {
+    char msg[512];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        snprintf(msg, sizeof(msg), "cannot load image %s: %s", path,
+                 strerror(errno));
+        if (fd >= 0) close(fd);
+        return lval_err(msg);
+    }
+    void* map = st.st_size >= (long) sizeof(image_header_t) ?
+        mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    image_header_t h;
+    if (map != MAP_FAILED) memcpy(&h, map, sizeof(h));
+    if (map == MAP_FAILED || memcmp(h.magic, "ALBAI\0\0\0", 8) != 0 ||
+        h.version != (IMAGE_VERSION << 16 | MODULE_VERSION) ||
+        h.wordSize != sizeof(long)) {
+        if (map != MAP_FAILED) munmap(map, st.st_size);
+        snprintf(msg, sizeof(msg), "%s is not an image of this interpreter",
+                 path);
+        return lval_err(msg);
+    }
+
+    module_in_t in = { (const char*) map + sizeof(h),
+                       (const char*) map + st.st_size, image_builtins };
+    // NB: names of an image are all different, so they only need to
+    //     be looked up among the bindings made before it
+    int before = e->count;
+    lval_t* err = NULL;
+    for (uint64_t j = 0; j < h.count && !err; ++j) {
+        lval_t* sym = module_get_form(&in);
+        lval_t* val = sym && sym->type == LVAL_SYM ? module_get_form(&in) : NULL;
+        if (val) {
+            int slot = 0;
+            while (slot < before && strcmp(e->syms[slot]->sym, sym->sym))
+                ++slot;
+            if (slot < before) {
+                lval_del(e->vals[slot]);
+                e->vals[slot] = val;
+                lval_del(sym);
+            } else {
+                env_push(e, sym, val);
+            }
+            continue;
+        }
+        if (sym) lval_del(sym);
+        snprintf(msg, sizeof(msg), "image %s is malformed", path);
+        err = lval_err(msg);
+    }
+    munmap(map, st.st_size);
+    return err;
+}
+
+/************/
+/* builtins */
+/************/
+
+// save-image (write bindings of environment to file, returns their number)
+lval_t* builtin_save_image(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "save-image");
+    LASSERTV_TYPES(argv, LVAL_STR, "save-image");
+
+    long len = argv[0]->str->len;
+    char* path = malloc(len + 1);
+    rope_copy_chars(argv[0]->str, 0, len, path);
+    path[len] = '\0';
+
+    int count = 0;
+    int err = image_save(env, path, &count);
+    lval_t* ret;
+    if (err) {
+        char msg[512];
+        snprintf(msg, sizeof(msg), "cannot save image %s: %s", path,
+                 strerror(err));
+        ret = lval_err(msg);
+    } else {
+        ret = lval_num(count);
+    }
+    free(path);
+    return ret;
+}
@@ -0,0 +1,295 @@
+#pragma once
+
+#include "core.h"
+#include "env.h"
+#include "builtin.h"
+#include "closure.h"
+
+/**********************************************************/
+/*            template JIT for arithmetic forms           */
+/*--------------------------------------------------------*/
+/* NB: compiled calls to + - * / whose operands are       */
+/*     numbers, globals or other such calls count how     */
+/*     many times they ran. Once hot, they are translated */
+/*     into x86-64 code in mmap'd executable memory.      */
+/*     Before every run, guards check that operator       */
+/*     symbols are still bound to their builtins and that */
+/*     global operands are still numbers; when a guard    */
+/*     fails (or an operation overflows or divides by 0,  */
+/*     which the interpreter reports as errors) the form  */
+/*     deoptimizes and runs on the closure interpreter.   */
+/**********************************************************/
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(ALBA_NO_JIT)
+#define JIT_ENABLED
+#include <sys/mman.h>
+#endif
+
+// number of runs after which a form is compiled
+// (and number of failed guards after which it is thrown away)
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD 16
+#endif
+
+// native code signature
+//  NB: returns 0 and stores result in out on success,
+//      non-zero when execution needs to deoptimize
+typedef int (*jit_fn_t)(const long* globals, long* out);
+
+// native code of a form along with its guards
+typedef struct jit_code_t {
+    jit_fn_t fn;
+    void* mem;
+    size_t size;
+    int count;          // number of guards
+    cnode_t** guards;   // global references the code depends on
+    builtinv_t* expect; // builtin expected for guard (NULL for numbers)
+    int fails;
+} jit_code_t;
+
+// free native code
+void jit_code_del(jit_code_t* jit) {
+#ifdef JIT_ENABLED
+    munmap(jit->mem, jit->size);
+#endif
+    free(jit->guards);
+    free(jit->expect);
+    free(jit);
+}
+
+// builtin implementing arithmetic operator symbol (NULL if none)
+builtinv_t jit_op_builtin(const char* sym) {
+    if (strcmp(sym, "+") == 0) return &builtin_add;
+    if (strcmp(sym, "-") == 0) return &builtin_subtract;
+    if (strcmp(sym, "*") == 0) return &builtin_multiply;
+    if (strcmp(sym, "/") == 0) return &builtin_divide;
+    return NULL;
+}
+
+// true if s-expression (borrowed) can be handled by the JIT
+int jit_is_candidate(const lval_t* v) {
+    if (v->type != LVAL_SEXPR || v->count < 2 ||
+        v->cell[0]->type != LVAL_SYM || !jit_op_builtin(v->cell[0]->sym))
+        return 0;
+
+    for (int j = 1; j < v->count; ++j) {
+        const lval_t* arg = v->cell[j];
+        if (arg->type != LVAL_NUM && arg->type != LVAL_SYM &&
+            !jit_is_candidate(arg))
+            return 0;
+    }
+
+    return 1;
+}
+
+#ifdef JIT_ENABLED
+
+/***********/
+/* codegen */
+/***********/
+
+// code buffer
+typedef struct {
+    unsigned char* data;
+    int size;
+    int* deopts; // positions of rel32 jumps to deoptimization stub
+    int deoptCount;
+} jit_buf_t;
+
+void jit_emit(jit_buf_t* b, const unsigned char* bytes, int n) {
+    b->data = realloc(b->data, b->size + n);
+    memcpy(b->data + b->size, bytes, n);
+    b->size += n;
+}
+#define JIT_EMIT(B, ...) do {                                   \
+        const unsigned char bytes_[] = { __VA_ARGS__ };         \
+        jit_emit(B, bytes_, sizeof(bytes_));                    \
+    } while (0)
+
+// emit 8 byte immediate
+void jit_emit_imm64(jit_buf_t* b, long imm) {
+    jit_emit(b, (const unsigned char*) &imm, sizeof(imm));
+}
+
+// emit conditional jump (0F cc) to deoptimization stub
+void jit_emit_deopt_jump(jit_buf_t* b, unsigned char cc) {
+    JIT_EMIT(b, 0x0F, cc, 0, 0, 0, 0);
+    b->deopts = realloc(b->deopts, sizeof(int) * (b->deoptCount + 1));
+    b->deopts[b->deoptCount++] = b->size - 4;
+}
+
+// add guard to native code
+int jit_add_guard(jit_code_t* jit, cnode_t* ref, builtinv_t expect) {
+    ++(jit->count);
+    jit->guards = realloc(jit->guards, sizeof(cnode_t*) * jit->count);
+    jit->expect = realloc(jit->expect, sizeof(builtinv_t) * jit->count);
+    jit->guards[jit->count - 1] = ref;
+    jit->expect[jit->count - 1] = expect;
+    return jit->count - 1;
+}
+
+// emit code leaving value of node in rax
+void jit_gen(jit_buf_t* b, jit_code_t* jit, cnode_t* n) {
+    // number: mov rax, imm64
+    if (n->fn == &cnode_const) {
+        JIT_EMIT(b, 0x48, 0xB8);
+        jit_emit_imm64(b, n->k->num);
+        return;
+    }
+
+    // global: mov rax, [rdi + 8 * guard]
+    if (n->fn == &cnode_global) {
+        int disp = jit_add_guard(jit, n, NULL) * sizeof(long);
+        JIT_EMIT(b, 0x48, 0x8B, 0x87);
+        jit_emit(b, (const unsigned char*) &disp, 4);
+        return;
+    }
+
+    // arithmetic call
+    const char* op = n->args[0]->k->sym;
+    jit_add_guard(jit, n->args[0], jit_op_builtin(op));
+
+    jit_gen(b, jit, n->args[1]);
+
+    // unary minus: neg rax
+    if (n->argc == 1 && op[0] == '-') {
+        JIT_EMIT(b, 0x48, 0xF7, 0xD8);
+        jit_emit_deopt_jump(b, 0x80);            // jo deopt
+        return;
+    }
+
+    for (int j = 2; j <= n->argc; ++j) {
+        JIT_EMIT(b, 0x50);                       // push rax
+        jit_gen(b, jit, n->args[j]);
+        JIT_EMIT(b, 0x48, 0x89, 0xC1);           // mov rcx, rax
+        JIT_EMIT(b, 0x58);                       // pop rax
+
+        switch (op[0]) {
+            // NB: any intermediate overflow deoptimizes, the
+            //     interpreter then decides on the exact result
+            case '+':
+                JIT_EMIT(b, 0x48, 0x01, 0xC8);             // add rax, rcx
+                jit_emit_deopt_jump(b, 0x80);              // jo deopt
+                break;
+            case '-':
+                JIT_EMIT(b, 0x48, 0x29, 0xC8);             // sub rax, rcx
+                jit_emit_deopt_jump(b, 0x80);              // jo deopt
+                break;
+            case '*':
+                JIT_EMIT(b, 0x48, 0x0F, 0xAF, 0xC1);       // imul rax, rcx
+                jit_emit_deopt_jump(b, 0x80);              // jo deopt
+                break;
+            case '/':
+                // division by 0 (and -1, which can trap) is left
+                // to the interpreter
+                JIT_EMIT(b, 0x48, 0x85, 0xC9);             // test rcx, rcx
+                jit_emit_deopt_jump(b, 0x84);              // jz deopt
+                JIT_EMIT(b, 0x48, 0x83, 0xF9, 0xFF);       // cmp rcx, -1
+                jit_emit_deopt_jump(b, 0x84);              // je deopt
+                JIT_EMIT(b, 0x48, 0x99);                   // cqo
+                JIT_EMIT(b, 0x48, 0xF7, 0xF9);             // idiv rcx
+                break;
+        }
+    }
+}
+
+// translate arithmetic call node into native code
+jit_code_t* jit_compile(cnode_t* n) {
+    jit_code_t* jit = malloc(sizeof(jit_code_t));
+    jit->count = 0;
+    jit->guards = NULL;
+    jit->expect = NULL;
+    jit->fails = 0;
+
+    jit_buf_t b = { NULL, 0, NULL, 0 };
+
+    // prologue: save rsp in rbx to unwind pushes on deoptimization
+    JIT_EMIT(&b, 0x53, 0x48, 0x89, 0xE3);        // push rbx; mov rbx, rsp
+    jit_gen(&b, jit, n);
+
+    // epilogue: store result and return 0
+    JIT_EMIT(&b, 0x48, 0x89, 0x06);              // mov [rsi], rax
+    JIT_EMIT(&b, 0x5B, 0x31, 0xC0, 0xC3);        // pop rbx; xor eax, eax; ret
+
+    // deoptimization stub: return 1
+    int stub = b.size;
+    JIT_EMIT(&b, 0x48, 0x89, 0xDC, 0x5B);        // mov rsp, rbx; pop rbx
+    JIT_EMIT(&b, 0xB8, 0x01, 0x00, 0x00, 0x00);  // mov eax, 1
+    JIT_EMIT(&b, 0xC3);                          // ret
+    for (int j = 0; j < b.deoptCount; ++j) {
+        int rel = stub - (b.deopts[j] + 4);
+        memcpy(b.data + b.deopts[j], &rel, 4);
+    }
+
+    // copy into executable memory
+    jit->size = b.size;
+    jit->mem = mmap(NULL, jit->size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->mem == MAP_FAILED) {
+        free(b.data); free(b.deopts);
+        jit->mem = NULL; jit->size = 0;
+        jit_code_del(jit);
+        return NULL;
+    }
+    memcpy(jit->mem, b.data, b.size);
+    free(b.data); free(b.deopts);
+
+    // NB: if the code cannot be made executable (e.g. W^X policies),
+    //     the form keeps running on the closure interpreter
+    if (mprotect(jit->mem, jit->size, PROT_READ | PROT_EXEC) < 0) {
+        jit_code_del(jit);
+        return NULL;
+    }
+    jit->fn = (jit_fn_t) jit->mem;
+    return jit;
+}
+
+// check guards and run native code
+//  NB: returns 0 if the form needs to run on the interpreter
+int jit_run(env_t* e, jit_code_t* jit, long* out) {
+    long globals[jit->count + 1];
+
+    for (int j = 0; j < jit->count; ++j) {
+        lval_t* val = cnode_resolve(e, jit->guards[j]);
+        if (!val) return 0;
+
+        if (jit->expect[j]) {
+            if (val->type != LVAL_BUILTIN || val->builtinv != jit->expect[j])
+                return 0;
+        } else {
+            if (val->type != LVAL_NUM)
+                return 0;
+            globals[j] = val->num;
+        }
+    }
+
+    return jit->fn(globals, out) == 0;
+}
+
+#endif
+
+// compiled arithmetic call: counts runs and tiers up to native code
+lval_t* jit_cnode_arith(env_t* e, cnode_t* n) {
+#ifdef JIT_ENABLED
+    if (n->jit) {
+        // charged like interpreted calls (see cnode_call_global)
+        //  NB: failed guards get charged twice, by the fallback too
+        if (!machine_charge()) return machine_starved();
+
+        long out;
+        if (jit_run(e, n->jit, &out))
+            return lval_num(out);
+
+        // deoptimize, throwing code away if guards keep failing
+        if (++(n->jit->fails) >= JIT_THRESHOLD) {
+            jit_code_del(n->jit);
+            n->jit = NULL;
+            n->hits = 0;
+        }
+    } else if (++(n->hits) == JIT_THRESHOLD) {
+        n->jit = jit_compile(n);
+    }
+#endif
+
+    return cnode_call_global(e, n);
+}
@@ -22,3 +22,22 @@
 #define LASSERT_TYPES(LVL, TP1, FNAME) \
     LASSERT(LVL->cell[0]->type == TP1, LVL, \
         "'" #FNAME "' needs to be passed a 1st argument of type '" #TP1 "'")
+
+/*********************************************************/
+/* variants for borrowing builtins (nothing to free)     */
+/*********************************************************/
+
+#define LASSERTV(CND, ERRMSG) \
+    if (!(CND)) return lval_err(ERRMSG);
+
+// functions bounds assertion
+#define LASSERTV_BOUNDS(ARGC, MINB, MAXB, FNAME) \
+    LASSERTV(ARGC >= MINB, \
+        "'" #FNAME "' function called with too few arguments") \
+    LASSERTV(ARGC <= MAXB, \
+        "'" #FNAME "' function called with too many arguments")
+
+// type of args
+#define LASSERTV_TYPES(ARGV, TP1, FNAME) \
+    LASSERTV(ARGV[0]->type == TP1, \
+        "'" #FNAME "' needs to be passed a 1st argument of type '" #TP1 "'")
@@ -0,0 +1,493 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "core.h"
+#include "expr.h"
+#include "env.h"
+#include "machine.h"
+#include "rope.h"
+#include "lassert.h"
+
+/**********************************************************/
+/*                 event loop and async I/O               */
+/*--------------------------------------------------------*/
+/* NB: async starts evaluating an expression as a task,   */
+/*     on a machine of its own (see machine.h). When a    */
+/*     task reads or writes a descriptor that is not      */
+/*     ready, its machine is suspended with the rest of   */
+/*     the evaluation as continuation, and the descriptor */
+/*     is handed to epoll. The loop resumes the machine   */
+/*     with the outcome of the operation once it is       */
+/*     ready. Tasks run on the thread of the repl, one at */
+/*     a time, and share its environment.                 */
+/*     The loop only runs while something waits on it:   */
+/*     await, or I/O outside of tasks (which runs the     */
+/*     tasks while waiting instead of blocking them).     */
+/*     Suspension only happens when the I/O builtin is    */
+/*     called by the task's machine itself: calls nested  */
+/*     in other builtins (e.g. reduce) wait in place.     */
+/*     Regular files are always ready, so reading and    */
+/*     writing them never suspends.                       */
+/*     Every descriptor can only be waited on by one      */
+/*     task at a time.                                    */
+/**********************************************************/
+
+// maximum number of bytes read at once
+#ifndef IO_READ_MAX
+#define IO_READ_MAX (1 << 20)
+#endif
+
+// pending operation of a task
+typedef enum {
+    IO_NONE,
+    IO_READ,
+    IO_WRITE,
+    IO_AWAIT,
+    IO_YIELD,
+    IO_SEND,  // see green.h
+    IO_RECV
+} io_op_t;
+
+// task (or request waiting outside of tasks, if m is NULL)
+typedef struct io_task_t {
+    int id;
+    machine_t* m;
+    int done;
+    lval_t* result;            // once done (until taken by await)
+    struct io_task_t* waiter;  // task awaiting this one
+    // pending operation
+    io_op_t op;
+    int fd;
+    long n;                    // read: maximum number of bytes
+    rope_t* data;              // write: string written
+    long off;                  // write: bytes written so far
+    lval_t* sent;              // send, yield: value to be handed over
+} io_task_t;
+
+// circular queue of pointers
+typedef struct {
+    void** items;
+    int head;
+    int count;
+    int cap;
+} io_queue_t;
+
+// event loop
+typedef struct {
+    int epfd;
+    io_task_t** tasks;  // by id (NULL once freed)
+    int count;
+    int cap;
+    io_queue_t ready;   // tasks to run
+    io_task_t** waits;  // task waiting on each descriptor (if any)
+    int waitCap;
+    int waiting;        // number of descriptors being waited on
+} io_loop_t;
+
+// loop of current thread (created on first use)
+//  NB: every actor has its own (see actor.h)
+__thread io_loop_t* io_global = NULL;
+io_loop_t* io_get(void) {
+    if (!io_global) {
+        io_global = calloc(1, sizeof(io_loop_t));
+        io_global->epfd = epoll_create1(EPOLL_CLOEXEC);
+    }
+    return io_global;
+}
+
+/**********/
+/* queues */
+/**********/
+
+// push item at the back of queue
+void io_queue_push(io_queue_t* q, void* item) {
+    if (q->count == q->cap) {
+        int cap = q->cap ? q->cap * 2 : 64;
+        void** items = malloc(sizeof(void*) * cap);
+        for (int j = 0; j < q->count; ++j)
+            items[j] = q->items[(q->head + j) % q->cap];
+        free(q->items);
+        q->items = items;
+        q->head = 0;
+        q->cap = cap;
+    }
+    q->items[(q->head + q->count++) % q->cap] = item;
+}
+
+// pop item from the front of queue (NULL if empty)
+void* io_queue_pop(io_queue_t* q) {
+    if (q->count == 0) return NULL;
+    void* item = q->items[q->head];
+    q->head = (q->head + 1) % q->cap;
+    --(q->count);
+    return item;
+}
+
+/**************/
+/* operations */
+/**************/
+
+// perform pending operation of t without blocking
+//  NB: returns 0 if the descriptor is not ready, otherwise sets
+//      t->result and returns 1
+int io_attempt(io_task_t* t) {
+    if (t->op == IO_READ) {
+        long n = t->n < IO_READ_MAX ? t->n : IO_READ_MAX;
+        char* buf = malloc(n > 0 ? n : 1);
+        long got = read(t->fd, buf, n);
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            free(buf);
+            return 0;
+        }
+        t->result = got < 0 ? lval_err(strerror(errno)) :
+                              lval_str(rope_flat(buf, got));
+        free(buf);
+        return 1;
+    }
+
+    if (t->op == IO_WRITE) {
+        char buf[4096];
+        while (t->off < t->data->len) {
+            long n = t->data->len - t->off;
+            if (n > (long) sizeof(buf)) n = sizeof(buf);
+            rope_copy_chars(t->data, t->off, n, buf);
+            long put = write(t->fd, buf, n);
+            if (put < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return 0;
+            if (put < 0) {
+                t->result = lval_err(strerror(errno));
+                return 1;
+            }
+            t->off += put;
+        }
+        t->result = lval_num(t->off);
+        return 1;
+    }
+
+    assert(0 && "attempting unknown operation");
+    t->result = lval_err("unknown operation!");
+    return 1;
+}
+
+// clear pending operation of t
+void io_clear(io_task_t* t) {
+    if (t->data) rope_release(t->data);
+    if (t->sent) lval_del(t->sent);
+    t->data = NULL;
+    t->sent = NULL;
+    t->op = IO_NONE;
+}
+
+// queue task to run
+void io_push_ready(io_loop_t* l, io_task_t* t) {
+    io_queue_push(&l->ready, t);
+}
+
+// complete operation of t with val (consumed)
+//  NB: tasks are resumed, requests outside of tasks are marked done
+void io_complete(io_loop_t* l, io_task_t* t, lval_t* val) {
+    io_clear(t);
+    if (!t->m) {
+        t->result = val;
+        t->done = 1;
+        return;
+    }
+    machine_resume(t->m, val);
+    io_push_ready(l, t);
+}
+
+// wait until descriptor of t is ready for its operation
+//  NB: returns an error if the descriptor is already waited on
+lval_t* io_wait(io_loop_t* l, io_task_t* t) {
+    if (t->fd >= l->waitCap) {
+        int cap = l->waitCap ? l->waitCap : 64;
+        while (cap <= t->fd) cap *= 2;
+        l->waits = realloc(l->waits, sizeof(io_task_t*) * cap);
+        memset(l->waits + l->waitCap, 0,
+               sizeof(io_task_t*) * (cap - l->waitCap));
+        l->waitCap = cap;
+    }
+    if (l->waits[t->fd])
+        return lval_err("descriptor is already being waited on!");
+
+    struct epoll_event ev;
+    ev.events = (t->op == IO_READ ? EPOLLIN : EPOLLOUT) | EPOLLONESHOT;
+    ev.data.ptr = t;
+    if (epoll_ctl(l->epfd, EPOLL_CTL_MOD, t->fd, &ev) < 0 &&
+        epoll_ctl(l->epfd, EPOLL_CTL_ADD, t->fd, &ev) < 0)
+        return lval_err(strerror(errno));
+
+    l->waits[t->fd] = t;
+    ++(l->waiting);
+    return NULL;
+}
+
+/********/
+/* loop */
+/********/
+
+// finish task whose machine is done
+void io_finish(io_loop_t* l, io_task_t* t) {
+    t->result = machine_result(t->m);
+    t->done = 1;
+
+    // hand result to task awaiting this one
+    if (t->waiter) {
+        io_task_t* w = t->waiter;
+        lval_t* val = t->result;
+        t->result = NULL;
+        l->tasks[t->id] = NULL;
+        machine_del(t->m);
+        free(t);
+        io_complete(l, w, val);
+    }
+}
+
+// run one round of the loop: ready tasks, or else wait for descriptors
+//  NB: returns 0 if there is nothing left to do
+int io_step(io_loop_t* l) {
+    // run ready tasks
+    //  NB: tasks waiting outside of their machine (e.g. in reduce) run
+    //      the loop from inside this one, and may empty the queue
+    //  NB: yielding tasks are resumed when their turn comes
+    if (l->ready.count) {
+        int n = l->ready.count;
+        io_task_t* t;
+        while (n-- && (t = io_queue_pop(&l->ready))) {
+            if (t->op == IO_YIELD) {
+                lval_t* val = t->sent;
+                t->sent = NULL;
+                io_clear(t);
+                machine_resume(t->m, val);
+            }
+            if (machine_run(t->m, -1)) io_finish(l, t);
+        }
+        return 1;
+    }
+    if (!l->waiting) return 0;
+
+    // wait for descriptors
+    struct epoll_event evs[64];
+    int n = epoll_wait(l->epfd, evs, 64, -1);
+    for (int j = 0; j < n; ++j) {
+        io_task_t* t = evs[j].data.ptr;
+        l->waits[t->fd] = NULL;
+        --(l->waiting);
+        if (io_attempt(t)) {
+            lval_t* val = t->result;
+            t->result = NULL;
+            io_complete(l, t, val);
+        } else {
+            lval_t* err = io_wait(l, t);
+            if (err) io_complete(l, t, err);
+        }
+    }
+    return 1;
+}
+
+// perform operation of request r, suspending the current task if any
+//  NB: outside of tasks, runs the loop until the operation is done
+lval_t* io_perform(io_task_t* r) {
+    if (io_attempt(r)) {
+        io_clear(r);
+        return r->result;
+    }
+
+    io_loop_t* l = io_get();
+
+    // inside task: move request to task and suspend
+    if (machine_current) {
+        io_task_t* t = machine_current->owner;
+        t->op = r->op; t->fd = r->fd; t->n = r->n;
+        t->data = r->data; t->off = r->off;
+        lval_t* err = io_wait(l, t);
+        if (err) {
+            io_clear(t);
+            return err;
+        }
+        machine_suspend(machine_current);
+        return lval_sexpr();
+    }
+
+    // outside task: run loop until done
+    lval_t* err = io_wait(l, r);
+    if (err) {
+        io_clear(r);
+        return err;
+    }
+    while (!r->done) io_step(l);
+    return r->result;
+}
+
+// free loop along with all of its tasks
+void io_shutdown(void) {
+    io_loop_t* l = io_global;
+    if (!l) return;
+
+    for (int j = 0; j < l->count; ++j) {
+        io_task_t* t = l->tasks[j];
+        if (!t) continue;
+        if (t->result) lval_del(t->result);
+        io_clear(t);
+        machine_del(t->m);
+        free(t);
+    }
+    close(l->epfd);
+    free(l->tasks);
+    free(l->ready.items);
+    free(l->waits);
+    free(l);
+    io_global = NULL;
+}
+
+/************/
+/* builtins */
+/************/
+
+// async (start evaluating q-expression as a task, returns its id)
+lval_t* builtin_async(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "async");
+    LASSERTV_TYPES(argv, LVAL_QEXPR, "async");
+
+    io_loop_t* l = io_get();
+    io_task_t* t = calloc(1, sizeof(io_task_t));
+    lval_t* expr = lval_copy(argv[0]);
+    expr->type = LVAL_SEXPR;
+    t->m = machine_new(env, expr);
+    t->m->owner = t;
+
+    if (l->count == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 16;
+        l->tasks = realloc(l->tasks, sizeof(io_task_t*) * l->cap);
+    }
+    t->id = l->count;
+    l->tasks[l->count++] = t;
+    io_push_ready(l, t);
+    return lval_num(t->id);
+}
+
+// await (value of task, waiting for it to finish)
+//  NB: the value can only be taken once
+lval_t* builtin_await(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "await");
+    LASSERTV_TYPES(argv, LVAL_NUM, "await");
+
+    io_loop_t* l = io_get();
+    long id = argv[0]->num;
+    LASSERTV(id >= 0 && id < l->count && l->tasks[id],
+             "'await' needs to be passed a task that was not awaited");
+    io_task_t* t = l->tasks[id];
+    LASSERTV(!t->waiter, "task is already awaited!");
+    LASSERTV(!machine_current || machine_current->owner != t,
+             "task cannot await itself!");
+
+    // inside task: suspend until t finishes (see io_finish)
+    if (!t->done && machine_current) {
+        io_task_t* self = machine_current->owner;
+        self->op = IO_AWAIT;
+        t->waiter = self;
+        machine_suspend(machine_current);
+        return lval_sexpr();
+    }
+
+    // outside task: run loop until t finishes
+    while (!t->done) {
+        if (!io_step(l))
+            return lval_err("'await' would wait forever!");
+    }
+
+    lval_t* ret = t->result;
+    l->tasks[id] = NULL;
+    machine_del(t->m);
+    free(t);
+    return ret;
+}
+
+// io-read (up to n bytes from descriptor, empty string at end of file)
+lval_t* builtin_io_read(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 2, 2, "io-read");
+    LASSERTV(argv[0]->type == LVAL_NUM && argv[1]->type == LVAL_NUM &&
+             argv[1]->num >= 0,
+             "'io-read' needs to be passed a descriptor and a count");
+
+    io_task_t r = { .op = IO_READ, .fd = argv[0]->num, .n = argv[1]->num };
+    return io_perform(&r);
+}
+
+// io-write (whole string to descriptor, returns number of bytes)
+lval_t* builtin_io_write(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 2, 2, "io-write");
+    LASSERTV(argv[0]->type == LVAL_NUM && argv[1]->type == LVAL_STR,
+             "'io-write' needs to be passed a descriptor and a string");
+
+    io_task_t r = { .op = IO_WRITE, .fd = argv[0]->num,
+                    .data = rope_retain(argv[1]->str) };
+    return io_perform(&r);
+}
+
+// io-open (non blocking descriptor of file, mode is "r", "w" or "a")
+lval_t* builtin_io_open(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 2, "io-open");
+    for (int j = 0; j < argc; ++j)
+        LASSERTV(argv[j]->type == LVAL_STR,
+                 "'io-open' needs to be passed a path and a mode");
+
+    int flags = O_RDONLY;
+    if (argc == 2) {
+        const rope_t* mode = argv[1]->str;
+        char c = mode->len == 1 ? rope_at(mode, 0) : '?';
+        LASSERTV(c == 'r' || c == 'w' || c == 'a',
+                 "'io-open' mode needs to be \"r\", \"w\" or \"a\"");
+        if (c == 'w') flags = O_WRONLY | O_CREAT | O_TRUNC;
+        if (c == 'a') flags = O_WRONLY | O_CREAT | O_APPEND;
+    }
+
+    const rope_t* path = argv[0]->str;
+    char* cpath = malloc(path->len + 1);
+    rope_copy_chars(path, 0, path->len, cpath);
+    cpath[path->len] = '\0';
+    int fd = open(cpath, flags | O_NONBLOCK | O_CLOEXEC, 0644);
+    free(cpath);
+
+    return fd < 0 ? lval_err(strerror(errno)) : lval_num(fd);
+}
+
+// io-close (close descriptor)
+lval_t* builtin_io_close(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "io-close");
+    LASSERTV_TYPES(argv, LVAL_NUM, "io-close");
+
+    io_loop_t* l = io_get();
+    int fd = argv[0]->num;
+    LASSERTV(fd >= l->waitCap || !l->waits[fd],
+             "cannot close descriptor being waited on!");
+    return close(fd) < 0 ? lval_err(strerror(errno)) : lval_sexpr();
+}
+
+// io-pairs (n connected pairs of non blocking local sockets)
+lval_t* builtin_io_pairs(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "io-pairs");
+    LASSERTV(argv[0]->type == LVAL_NUM && argv[0]->num >= 0,
+             "'io-pairs' needs to be passed a count");
+
+    lval_t* ret = lval_qexpr();
+    for (long j = 0; j < argv[0]->num; ++j) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                       0, fds) < 0) {
+            lval_del(ret);
+            return lval_err(strerror(errno));
+        }
+        lval_t* pair = lval_qexpr();
+        lval_add(pair, lval_num(fds[0]));
+        lval_add(pair, lval_num(fds[1]));
+        lval_add(ret, pair);
+    }
+    return ret;
+}
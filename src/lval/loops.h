@@ -0,0 +1,149 @@
+#pragma once
+
+#include "core.h"
+#include "expr.h"
+#include "env.h"
+#include "eval.h"
+#include "closure.h"
+#include "seq.h"
+#include "machine.h"
+#include "lassert.h"
+
+/**********************************************************/
+/*                      native loops                      */
+/*--------------------------------------------------------*/
+/* NB: loops run the q-expressions they are passed over   */
+/*     and over through their compiled forms (see         */
+/*     closure.h), which are compiled once and cached on  */
+/*     the q-expressions, instead of evaluating copies of */
+/*     them like recursive evals do. Loop variables are   */
+/*     global bindings (environments are flat) created    */
+/*     once per loop: counters are updated in place and   */
+/*     stay bound after the loop. A loop stops at the     */
+/*     first error of its body, and when the budget of    */
+/*     the evaluation runs out (see machine.h): every     */
+/*     iteration is charged, on top of the calls made by  */
+/*     the body. Bodies cannot suspend green threads.     */
+/**********************************************************/
+
+// run compiled form once, charging an iteration to the budget (if any)
+lval_t* loops_run(env_t* e, cnode_t* code) {
+    if (!machine_charge()) return machine_starved();
+    return lval_force(e, cnode_run(e, code));
+}
+
+// slot of binding of loop variable, bound to val (consumed)
+int loops_bind(env_t* e, const lval_t* sym, lval_t* val) {
+    env_add(e, lval_copy(sym), val);
+    return env_slot(e, sym->sym);
+}
+
+// true if q-expression is a single symbol
+int loops_is_var(const lval_t* v) {
+    return v->type == LVAL_QEXPR && v->count == 1 &&
+           v->cell[0]->type == LVAL_SYM;
+}
+
+/************/
+/* builtins */
+/************/
+
+// while (run body as long as condition holds, returns last value)
+lval_t* builtin_while(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 2, 2, "while");
+    LASSERTV(argv[0]->type == LVAL_QEXPR && argv[1]->type == LVAL_QEXPR,
+             "'while' needs to be passed a condition and a body");
+
+    cnode_t* cond = closure_code(env, argv[0]);
+    cnode_t* body = closure_code(env, argv[1]);
+    lval_t* ret = lval_sexpr();
+    while (1) {
+        lval_t* c = loops_run(env, cond);
+        if (c->type == LVAL_ERR || !lval_is_true(c)) {
+            if (c->type == LVAL_ERR) {
+                lval_del(ret);
+                ret = c;
+            } else {
+                lval_del(c);
+            }
+            return ret;
+        }
+        lval_del(c);
+
+        lval_del(ret);
+        ret = loops_run(env, body);
+        if (ret->type == LVAL_ERR) return ret;
+    }
+}
+
+// dotimes (run body with variable counting from 0 to n - 1)
+//  NB: returns the last value of the body
+lval_t* builtin_dotimes(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 3, 3, "dotimes");
+    LASSERTV(loops_is_var(argv[0]) && argv[1]->type == LVAL_NUM &&
+             argv[2]->type == LVAL_QEXPR,
+             "'dotimes' needs to be passed a variable, a count and a body");
+
+    cnode_t* body = closure_code(env, argv[2]);
+    int slot = loops_bind(env, argv[0]->cell[0], lval_num(0));
+    lval_t* ret = lval_sexpr();
+    for (long j = 0; j < argv[1]->num; ++j) {
+        // NB: the body may have rebound the variable to anything
+        lval_t* var = env->vals[slot];
+        if (var->type == LVAL_NUM) {
+            var->num = j;
+        } else {
+            lval_del(var);
+            env->vals[slot] = lval_num(j);
+        }
+
+        lval_del(ret);
+        ret = loops_run(env, body);
+        if (ret->type == LVAL_ERR) break;
+    }
+    return ret;
+}
+
+// fold (run body with accumulator and every element of sequence)
+//  NB: the accumulator starts as init and takes the value of the
+//      body after every element, e.g. (fold {acc x} 0 xs {+ acc x})
+lval_t* builtin_fold(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 4, 4, "fold");
+    LASSERTV(argv[0]->type == LVAL_QEXPR && argv[0]->count == 2 &&
+             argv[0]->cell[0]->type == LVAL_SYM &&
+             argv[0]->cell[1]->type == LVAL_SYM &&
+             argv[3]->type == LVAL_QEXPR,
+             "'fold' needs to be passed two variables, an initial value, "
+             "a sequence and a body");
+
+    seq_t* s = seq_of(argv[2]);
+    LASSERTV(s, "'fold' needs to be passed a sequence");
+
+    cnode_t* body = closure_code(env, argv[3]);
+    int acc = loops_bind(env, argv[0]->cell[0], lval_copy(argv[1]));
+    int var = loops_bind(env, argv[0]->cell[1], lval_nil());
+
+    seq_iter_t* it = seq_iter_new(s);
+    lval_t* ret = NULL;
+    lval_t* x;
+    while ((x = seq_iter_next(env, it))) {
+        if (x->type == LVAL_ERR) {
+            ret = x;
+            break;
+        }
+        lval_del(env->vals[var]);
+        env->vals[var] = x;
+
+        lval_t* val = loops_run(env, body);
+        if (val->type == LVAL_ERR) {
+            ret = val;
+            break;
+        }
+        lval_del(env->vals[acc]);
+        env->vals[acc] = val;
+    }
+
+    seq_iter_del(it);
+    seq_release(s);
+    return ret ? ret : lval_copy(env->vals[acc]);
+}
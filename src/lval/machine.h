@@ -0,0 +1,392 @@
+#pragma once
+
+#include <signal.h>
+#include <sys/time.h>
+
+#include "core.h"
+#include "expr.h"
+#include "env.h"
+#include "eval.h"
+#include "lassert.h"
+
+/**********************************************************/
+/*             explicit continuation stack machine        */
+/*--------------------------------------------------------*/
+/* NB: evaluates expressions without recursing on the C   */
+/*     stack: every s-expression whose arguments are      */
+/*     being evaluated is kept in a frame on a growable   */
+/*     heap stack. The machine can be stopped after any   */
+/*     number of steps and resumed later, and it fails    */
+/*     with an error instead of crashing when nesting     */
+/*     goes beyond its depth limit. Machines owned by a   */
+/*     task of the event loop can also be suspended by    */
+/*     the builtin they call, and resumed with the value  */
+/*     of the call later on (see loop.h). Runs can be     */
+/*     given a budget of steps (fuel) and a wall-clock    */
+/*     deadline: when either runs out, the run stops and  */
+/*     can be resumed with more fuel later, or dropped    */
+/*     along with all it holds (machine_del). Evaluations */
+/*     nested in the steps of a budgeted run (builtins    */
+/*     calling functions, loops, sequences) charge its    */
+/*     budget too, and fail with machine_starved() once   */
+/*     it runs out. Green threads run unbudgeted.         */
+/**********************************************************/
+
+// default maximum number of frames
+#ifndef MACHINE_DEPTH_LIMIT
+#define MACHINE_DEPTH_LIMIT (1 << 20)
+#endif
+
+// s-expression whose children are being evaluated
+//  NB: cells before next are evaluated, cell next is in flight
+//      (owned by the machine) and the ones after it are pending
+typedef struct {
+    lval_t* expr;
+    int next;
+} mframe_t;
+
+// machine state
+typedef struct {
+    env_t* env;
+    mframe_t* frames;
+    int count;
+    int cap;
+    int limit;     // maximum number of frames
+    lval_t* expr;  // expression to evaluate next (if any)
+    lval_t* value; // value to return to the top frame (if any)
+    void* owner;   // task owning the machine (NULL if it cannot suspend)
+    int suspended; // waiting for value to be replaced (see machine_resume)
+} machine_t;
+
+// set (by SIGALRM) once the deadline of budgeted runs has passed
+//  NB: only checked by runs with a budget, see machine_run
+volatile sig_atomic_t machine_deadline = 0;
+
+// steps left to the budgeted run of current thread (negative if none)
+//  NB: shared by the machine and all evaluations nested in its steps
+//      (see machine_charge), so that builtins cannot escape the budget
+__thread long machine_budget = -1;
+
+// budget shared by the threads running a parallel call (NULL if none)
+//  NB: when set, steps are drawn from it instead, and machine_budget
+//      only tells that there is a budget (see par.h)
+__thread long* machine_shared = NULL;
+
+// machine calling a suspending builtin (NULL if none)
+//  NB: only set while such a builtin is called straight from a machine
+//      that can suspend, never during nested evaluations
+__thread machine_t* machine_current = NULL;
+
+// create machine evaluating v (consumed) in environment e
+machine_t* machine_new(env_t* e, lval_t* v) {
+    machine_t* m = malloc(sizeof(machine_t));
+    m->env = e;
+    m->frames = NULL;
+    m->count = 0;
+    m->cap = 0;
+    m->limit = MACHINE_DEPTH_LIMIT;
+    m->expr = v;
+    m->value = NULL;
+    m->owner = NULL;
+    m->suspended = 0;
+    return m;
+}
+
+// free frame along with the s-expression it owns
+void mframe_del(mframe_t* f) {
+    lval_t* v = f->expr;
+    for (int j = 0; j < v->count; ++j)
+        if (j != f->next) lval_del(v->cell[j]);
+    v->count = 0;
+    lval_del(v);
+}
+
+// drop all frames and pending work
+void machine_unwind(machine_t* m) {
+    while (m->count)
+        mframe_del(&m->frames[--(m->count)]);
+    if (m->expr)  { lval_del(m->expr);  m->expr = NULL; }
+    if (m->value) { lval_del(m->value); m->value = NULL; }
+}
+
+// free machine, releasing everything it still owns
+void machine_del(machine_t* m) {
+    machine_unwind(m);
+    free(m->frames);
+    free(m);
+}
+
+// true if machine produced its final value
+int machine_done(const machine_t* m) {
+    return !m->expr && m->count == 0 && !m->suspended;
+}
+
+// take final value out of finished machine
+lval_t* machine_result(machine_t* m) {
+    assert(machine_done(m) && "taking result of unfinished machine");
+    lval_t* ret = m->value;
+    m->value = NULL;
+    return ret;
+}
+
+// abort evaluation, making err the final value
+void machine_fail(machine_t* m, lval_t* err) {
+    machine_unwind(m);
+    m->value = err;
+}
+
+// push frame for s-expression and start evaluating its first child
+void machine_push(machine_t* m, lval_t* v) {
+    if (m->count == m->limit) {
+        lval_del(v);
+        machine_fail(m, lval_err("evaluation depth limit exceeded!"));
+        return;
+    }
+
+    // grow stack
+    if (m->count == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 16;
+        m->frames = realloc(m->frames, sizeof(mframe_t) * m->cap);
+    }
+
+    // cells are overwritten with their values from now on
+    lval_detach(v);
+    m->frames[m->count++] = (mframe_t){ v, 0 };
+    m->expr = v->cell[0];
+}
+
+// apply s-expression whose children are all evaluated
+//  NB: errors never make it into frames (see machine_step)
+void machine_apply(machine_t* m, lval_t* v) {
+    // 1 element: take it (eliminating parentheses)
+    if (v->count == 1) {
+        m->value = lval_take(v, 0);
+        return;
+    }
+
+    // 2 or more: call first element
+    //  NB: borrowing builtins read their arguments in place
+    lval_t* ret;
+    lval_t* f = v->cell[0];
+    if (f->type == LVAL_BUILTIN && f->builtinv) {
+        if (f->suspends && m->owner) machine_current = m;
+        ret = f->builtinv(m->env, v->count - 1, &v->cell[1]);
+        machine_current = NULL;
+        lval_del(v);
+    } else {
+        ret = lval_call(m->env, lval_pop(v, 0), v);
+    }
+
+    // tail calls are evaluated in place of the call
+    if (ret->type == LVAL_TAIL) {
+        m->expr = ret->tail;
+        m->expr->type = LVAL_SEXPR;
+        ret->tail = NULL;
+        lval_free(ret);
+    } else {
+        m->value = ret;
+    }
+}
+
+// perform one evaluation step
+void machine_step(machine_t* m) {
+    // evaluate pending expression
+    if (m->expr) {
+        lval_t* v = m->expr;
+        m->expr = NULL;
+
+        switch (v->type) {
+            case LVAL_NUM: case LVAL_ERR: case LVAL_QEXPR: case LVAL_BUILTIN:
+            case LVAL_VEC: case LVAL_STR: case LVAL_MAP: case LVAL_SEQ:
+                m->value = v;
+                return;
+            case LVAL_SYM:
+                m->value = env_find(m->env, v);
+                lval_del(v);
+                return;
+            case LVAL_TAIL:
+                m->expr = v->tail;
+                m->expr->type = LVAL_SEXPR;
+                v->tail = NULL;
+                lval_free(v);
+                return;
+            case LVAL_SEXPR:
+                // 0 elements: evaluate to itself
+                if (v->count == 0) m->value = v;
+                else               machine_push(m, v);
+                return;
+            default:
+                assert(0 && "trying to evaluate lval of unknown type");
+        }
+    }
+
+    // errors abort the whole evaluation, releasing all frames at once
+    //  NB: an error always ends up being the result of the form,
+    //      so nothing else needs to be evaluated
+    if (m->value->type == LVAL_ERR) {
+        lval_t* err = m->value;
+        m->value = NULL;
+        machine_fail(m, err);
+        return;
+    }
+
+    // return value to top frame
+    mframe_t* f = &m->frames[m->count - 1];
+    f->expr->cell[f->next++] = m->value;
+    m->value = NULL;
+
+    // continue with next child or apply
+    if (f->next < f->expr->count) {
+        m->expr = f->expr->cell[f->next];
+    } else {
+        lval_t* v = f->expr;
+        --(m->count);
+        machine_apply(m, v);
+    }
+}
+
+// suspend machine calling a suspending builtin
+//  NB: the value the builtin returns is a placeholder, replaced by
+//      machine_resume
+void machine_suspend(machine_t* m) {
+    m->suspended = 1;
+}
+
+// resume suspended machine, with val (consumed) as value of the call
+void machine_resume(machine_t* m, lval_t* val) {
+    assert(m->suspended && "resuming machine that is not suspended");
+    lval_del(m->value);
+    m->value = val;
+    m->suspended = 0;
+}
+
+// run machine for at most steps steps (or until done if negative)
+//  NB: returns 1 if the machine finished, 0 if it ran out of steps,
+//      got suspended or (with steps given) passed the deadline
+int machine_run(machine_t* m, long steps) {
+    while (!machine_done(m)) {
+        if (steps == 0 || m->suspended) return 0;
+        if (steps > 0) {
+            if (machine_deadline) return 0;
+            --steps;
+        }
+        machine_step(m);
+    }
+    return 1;
+}
+
+// charge a step to the budgeted run of current thread, if any
+//  NB: returns 0 if the budget ran out or the deadline passed, in which
+//      case the caller should return machine_starved()
+int machine_charge(void) {
+    if (machine_budget < 0) return 1;
+    if (machine_budget == 0 || machine_deadline) return 0;
+    if (machine_shared)
+        return __atomic_sub_fetch(machine_shared, 1, __ATOMIC_RELAXED) >= 0;
+    --machine_budget;
+    return 1;
+}
+
+// steps left to the budgeted run of current thread (negative if none)
+long machine_left(void) {
+    if (machine_budget < 0 || !machine_shared) return machine_budget;
+    long left = __atomic_load_n(machine_shared, __ATOMIC_RELAXED);
+    return left > 0 ? left : 0;
+}
+
+// charge n steps at once to the budgeted run of current thread, if any
+void machine_spend(long n) {
+    if (machine_budget < 0) return;
+    if (machine_shared) {
+        __atomic_sub_fetch(machine_shared, n, __ATOMIC_RELAXED);
+    } else {
+        machine_budget = machine_budget > n ? machine_budget - n : 0;
+    }
+}
+
+// SIGALRM handler
+void machine_alarm(int sig) {
+    machine_deadline = 1;
+}
+
+// set deadline of budgeted runs ms milliseconds from now (0 clears it)
+void machine_set_deadline(long ms) {
+    static struct sigaction sa;
+    if (!sa.sa_handler) {
+        sa.sa_handler = &machine_alarm;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGALRM, &sa, NULL);
+    }
+
+    struct itimerval t = { { 0, 0 }, { ms / 1000, (ms % 1000) * 1000 } };
+    machine_deadline = 0;
+    setitimer(ITIMER_REAL, &t, NULL);
+}
+
+// run machine with given fuel (maximum number of steps)
+//  NB: returns the final value, or NULL if the machine ran out of fuel
+//      or passed the deadline: it can then be run again with more fuel,
+//      or be freed with machine_del
+//  NB: steps taken by evaluations nested in the steps of the machine
+//      are charged too, and a run nested in another one never gets more
+//      fuel than the outer run has left
+lval_t* machine_fuel(machine_t* m, long fuel) {
+    long outer = machine_budget;
+    long* shared = machine_shared;
+    long left = machine_left();
+    machine_shared = NULL;
+    machine_budget = left >= 0 && left < fuel ? left : fuel;
+    long start = machine_budget;
+
+    while (!machine_done(m) && !m->suspended && machine_charge())
+        machine_step(m);
+
+    long used = start - machine_budget;
+    machine_budget = outer;
+    machine_shared = shared;
+    machine_spend(used);
+    return machine_done(m) ? machine_result(m) : NULL;
+}
+
+// error explaining why a budgeted run stopped
+lval_t* machine_starved(void) {
+    return lval_err(machine_deadline ? "evaluation ran out of time!" :
+                                       "evaluation ran out of fuel!");
+}
+
+// evaluate lval (consumed) to completion on a fresh machine
+//  NB: limit is the maximum nesting depth (0 for the default). Steps
+//      are charged to the budgeted run of current thread, if any
+lval_t* machine_eval(env_t* e, lval_t* v, int limit) {
+    machine_t* m = machine_new(e, v);
+    if (limit > 0) m->limit = limit;
+
+    lval_t* ret;
+    if (machine_budget >= 0) {
+        ret = machine_fuel(m, machine_left());
+        if (!ret) ret = machine_starved();
+    } else {
+        machine_run(m, -1);
+        ret = machine_result(m);
+    }
+
+    machine_del(m);
+    return ret;
+}
+
+// with-fuel (value of q-expression evaluated in at most n steps)
+//  NB: the evaluation is dropped, with an error, if it runs out
+lval_t* builtin_with_fuel(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 2, 2, "with-fuel");
+    LASSERTV(argv[0]->type == LVAL_NUM && argv[0]->num >= 0 &&
+             argv[1]->type == LVAL_QEXPR,
+             "'with-fuel' needs to be passed a number of steps and a q-expression");
+
+    lval_t* expr = lval_copy(argv[1]);
+    expr->type = LVAL_SEXPR;
+    machine_t* m = machine_new(env, expr);
+    lval_t* ret = machine_fuel(m, argv[0]->num);
+    if (!ret) ret = machine_starved();
+    machine_del(m);
+    return ret;
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include "core.h"
+#include "expr.h"
+#include "hash.h"
+
+/**********************************************************/
+/*                      hash maps                         */
+/*--------------------------------------------------------*/
+/* NB: open addressing with linear probing and Robin Hood */
+/*     displacement: an entry being inserted takes the    */
+/*     slot of any entry closer to its home slot, which   */
+/*     keeps probe sequences short and lets lookups stop  */
+/*     early. Deletion shifts the following entries back  */
+/*     instead of leaving tombstones. Keys are compared   */
+/*     structurally (see hash.h).                         */
+/*     Tables are shared between copies of a map and are  */
+/*     only modified in place when not shared.            */
+/**********************************************************/
+
+// tables are grown past this load factor (in eighths)
+#define HMAP_LOAD 7
+
+// table slot (empty if key is NULL)
+typedef struct {
+    lval_t* key;
+    lval_t* val;
+    unsigned long hash;
+    int dist; // distance from home slot
+} hmap_slot_t;
+
+// hash table
+typedef struct hmap_t {
+    int refs;
+    int count;
+    int cap;  // power of 2 (or 0)
+    hmap_slot_t* slots;
+} hmap_t;
+
+// create empty table
+hmap_t* hmap_new(void) {
+    hmap_t* m = malloc(sizeof(hmap_t));
+    m->refs = 1;
+    m->count = 0;
+    m->cap = 0;
+    m->slots = NULL;
+    return m;
+}
+
+// take new reference to table
+hmap_t* hmap_retain(hmap_t* m) {
+    ++(m->refs);
+    return m;
+}
+
+// release reference to table
+void hmap_release(hmap_t* m) {
+    if (--(m->refs) > 0) return;
+
+    for (int j = 0; j < m->cap; ++j) {
+        if (m->slots[j].key) {
+            lval_del(m->slots[j].key);
+            lval_del(m->slots[j].val);
+        }
+    }
+    free(m->slots);
+    free(m);
+}
+
+// place entry known not to be in the table, displacing richer ones
+void hmap_place(hmap_t* m, hmap_slot_t in) {
+    int mask = m->cap - 1;
+    int j = in.hash & mask;
+    in.dist = 0;
+
+    for (;; j = (j + 1) & mask, ++(in.dist)) {
+        hmap_slot_t* s = &m->slots[j];
+        if (!s->key) {
+            *s = in;
+            ++(m->count);
+            return;
+        }
+        if (s->dist < in.dist) {
+            hmap_slot_t tmp = *s;
+            *s = in;
+            in = tmp;
+        }
+    }
+}
+
+// double capacity of table
+void hmap_grow(hmap_t* m) {
+    int oldCap = m->cap;
+    hmap_slot_t* old = m->slots;
+
+    m->cap = oldCap ? oldCap * 2 : 8;
+    m->slots = calloc(m->cap, sizeof(hmap_slot_t));
+    m->count = 0;
+    for (int j = 0; j < oldCap; ++j)
+        if (old[j].key) hmap_place(m, old[j]);
+
+    free(old);
+}
+
+// index of slot holding key (-1 if none)
+int hmap_find(const hmap_t* m, const lval_t* key, unsigned long hash) {
+    if (m->count == 0) return -1;
+
+    int mask = m->cap - 1;
+    int j = hash & mask;
+    for (int dist = 0;; j = (j + 1) & mask, ++dist) {
+        const hmap_slot_t* s = &m->slots[j];
+        // NB: an entry further from its home than this key would
+        //     have been displaced by it
+        if (!s->key || s->dist < dist) return -1;
+        if (s->hash == hash && lval_eq(s->key, key)) return j;
+    }
+}
+
+// value bound to key (borrowed, NULL if none)
+lval_t* hmap_get(const hmap_t* m, const lval_t* key) {
+    int j = hmap_find(m, key, lval_hash(key));
+    return j < 0 ? NULL : m->slots[j].val;
+}
+
+// bind key to val (both consumed), replacing previous binding
+void hmap_put(hmap_t* m, lval_t* key, lval_t* val) {
+    unsigned long hash = lval_hash(key);
+
+    int j = hmap_find(m, key, hash);
+    if (j >= 0) {
+        lval_del(key);
+        lval_del(m->slots[j].val);
+        m->slots[j].val = val;
+        return;
+    }
+
+    if ((m->count + 1) * 8 > m->cap * HMAP_LOAD)
+        hmap_grow(m);
+    hmap_place(m, (hmap_slot_t){ key, val, hash, 0 });
+}
+
+// remove binding of key (if any)
+void hmap_remove(hmap_t* m, const lval_t* key) {
+    int j = hmap_find(m, key, lval_hash(key));
+    if (j < 0) return;
+
+    lval_del(m->slots[j].key);
+    lval_del(m->slots[j].val);
+    --(m->count);
+
+    // shift following entries back towards their home slots
+    int mask = m->cap - 1;
+    int next = (j + 1) & mask;
+    while (m->slots[next].key && m->slots[next].dist > 0) {
+        m->slots[j] = m->slots[next];
+        --(m->slots[j].dist);
+        j = next;
+        next = (next + 1) & mask;
+    }
+    m->slots[j].key = NULL;
+    m->slots[j].val = NULL;
+}
+
+// copy of table, copying keys and values with copy
+hmap_t* hmap_clone(const hmap_t* m, lval_t* (*copy)(const lval_t*)) {
+    hmap_t* ret = hmap_new();
+    ret->count = m->count;
+    ret->cap = m->cap;
+    ret->slots = m->cap ? malloc(sizeof(hmap_slot_t) * m->cap) : NULL;
+
+    for (int j = 0; j < m->cap; ++j) {
+        ret->slots[j] = m->slots[j];
+        if (m->slots[j].key) {
+            ret->slots[j].key = copy(m->slots[j].key);
+            ret->slots[j].val = copy(m->slots[j].val);
+        }
+    }
+    return ret;
+}
+
+// order independent hash of entries
+unsigned long hmap_hash(const hmap_t* m) {
+    unsigned long h = 0;
+    for (int j = 0; j < m->cap; ++j)
+        if (m->slots[j].key)
+            h += hash_mix(m->slots[j].hash ^ lval_hash(m->slots[j].val));
+    return h;
+}
+
+// true if a and b hold equal bindings
+int hmap_eq(const hmap_t* a, const hmap_t* b) {
+    if (a == b) return 1;
+    if (a->count != b->count) return 0;
+
+    for (int j = 0; j < a->cap; ++j) {
+        const hmap_slot_t* s = &a->slots[j];
+        if (!s->key) continue;
+        int k = hmap_find(b, s->key, s->hash);
+        if (k < 0 || !lval_eq(s->val, b->slots[k].val)) return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,281 @@
+#pragma once
+
+#include "core.h"
+#include "expr.h"
+#include "eval.h"
+#include "hash.h"
+#include "map.h"
+#include "rope.h"
+#include "seq.h"
+#include "lassert.h"
+
+/**********************************************************/
+/*                      memoization                       */
+/*--------------------------------------------------------*/
+/* NB: (memo f a b ...) is (f a b ...), except that the   */
+/*     result is kept and handed back the next time f is  */
+/*     called with equal arguments. Calls are looked up   */
+/*     by the structural hash of the function and its     */
+/*     arguments, and compared in full (see hash.h), so   */
+/*     collisions never return a wrong result. Sequences  */
+/*     are only equal to themselves, so calls on a fresh  */
+/*     (range n) are never found again.                   */
+/*     f is trusted to be pure: a function referring to   */
+/*     names that are later redefined keeps returning     */
+/*     the old results (memo-cap 0 drops them all).       */
+/*     Errors are not kept. The results kept take up to   */
+/*     memo_max_bytes (as estimated by memo_size); past   */
+/*     that, results are evicted in CLOCK order: the      */
+/*     hand sweeps over the entries, sparing once those   */
+/*     used since it last went by.                        */
+/*     Every thread has a cache of its own.               */
+/**********************************************************/
+
+// default maximum bytes of results kept
+#ifndef MEMO_CAP
+#define MEMO_CAP (64L << 20)
+#endif
+
+// kept call (unused if fn is NULL)
+typedef struct {
+    lval_t* fn;
+    lval_t** args;
+    int argc;
+    lval_t* val;
+    unsigned long hash;
+    long size;
+    int used; // called since the hand last went by
+    int next; // next entry of bucket, or of free list (-1 if none)
+} memo_entry_t;
+
+// cache of calls
+typedef struct {
+    memo_entry_t* entries;
+    int count;    // entries in use
+    int cap;
+    int free;     // first unused entry (-1 if none)
+    int* buckets; // first entry of every bucket (-1 if none)
+    int bucketCap;// power of 2 (or 0)
+    int hand;
+    long bytes;
+    // statistics
+    long hits;
+    long misses;
+    long evictions;
+} memo_t;
+
+// maximum bytes of results kept (by every thread)
+long memo_max_bytes = MEMO_CAP;
+
+// cache of current thread
+__thread memo_t memo_cache = { NULL, 0, 0, -1, NULL, 0, 0, 0, 0, 0, 0 };
+
+// estimated bytes taken by lval
+long memo_size(const lval_t* v) {
+    long size = sizeof(lval_t);
+
+    switch (v->type) {
+        case LVAL_ERR: return size + strlen(v->err) + 1;
+        case LVAL_SYM: return size + strlen(v->sym) + 1;
+        case LVAL_STR: return size + v->str->len;
+        case LVAL_VEC: return size + sizeof(long) * v->len;
+        case LVAL_MAP: return size + sizeof(hmap_slot_t) * v->map->cap;
+        case LVAL_SEXPR: case LVAL_QEXPR:
+            size += sizeof(lval_t*) * v->count;
+            for (int j = 0; j < v->count; ++j) size += memo_size(v->cell[j]);
+            return size;
+        default:       return size;
+    }
+}
+
+// structural hash of call
+//  NB: same as the hash of the s-expression of the call
+unsigned long memo_hash(const lval_t* fn, int argc, lval_t* const* argv) {
+    unsigned long h = 0xcbf29ce484222325UL ^ LVAL_SEXPR;
+    h = hash_mix(h + lval_hash(fn));
+    for (int j = 0; j < argc; ++j) h = hash_mix(h + lval_hash(argv[j]));
+    return h;
+}
+
+// index of entry kept for call (-1 if none)
+int memo_find(const memo_t* c, unsigned long hash,
+              const lval_t* fn, int argc, lval_t* const* argv) {
+    if (c->bucketCap == 0) return -1;
+
+    for (int j = c->buckets[hash & (c->bucketCap - 1)]; j >= 0;
+         j = c->entries[j].next) {
+        const memo_entry_t* m = &c->entries[j];
+        if (m->hash != hash || m->argc != argc || !lval_eq(m->fn, fn))
+            continue;
+        int k = 0;
+        while (k < argc && lval_eq(m->args[k], argv[k])) ++k;
+        if (k == argc) return j;
+    }
+    return -1;
+}
+
+// link entry j into its bucket
+void memo_link(memo_t* c, int j) {
+    int* b = &c->buckets[c->entries[j].hash & (c->bucketCap - 1)];
+    c->entries[j].next = *b;
+    *b = j;
+}
+
+// drop entry j
+void memo_evict(memo_t* c, int j) {
+    memo_entry_t* m = &c->entries[j];
+
+    // unlink from bucket
+    int* p = &c->buckets[m->hash & (c->bucketCap - 1)];
+    while (*p != j) p = &c->entries[*p].next;
+    *p = m->next;
+
+    lval_del(m->fn);
+    for (int k = 0; k < m->argc; ++k) lval_del(m->args[k]);
+    free(m->args);
+    lval_del(m->val);
+    c->bytes -= m->size;
+    --(c->count);
+
+    m->fn = NULL;
+    m->next = c->free;
+    c->free = j;
+}
+
+// evict entries until bytes more fit under the cap
+void memo_make_room(memo_t* c, long bytes) {
+    while (c->count > 0 && c->bytes + bytes > memo_max_bytes) {
+        memo_entry_t* m = &c->entries[c->hand];
+        if (m->fn && m->used) {
+            m->used = 0;
+        } else if (m->fn) {
+            memo_evict(c, c->hand);
+            ++(c->evictions);
+        }
+        c->hand = (c->hand + 1) % c->cap;
+    }
+}
+
+// keep result of call (copies everything)
+void memo_put(memo_t* c, unsigned long hash, const lval_t* fn,
+              int argc, lval_t* const* argv, const lval_t* val) {
+    long size = sizeof(memo_entry_t) + memo_size(fn) + memo_size(val);
+    for (int j = 0; j < argc; ++j) size += memo_size(argv[j]);
+    if (size > memo_max_bytes) return;
+    memo_make_room(c, size);
+
+    // grow entries, threading new ones onto the free list
+    if (c->free < 0) {
+        int oldCap = c->cap;
+        c->cap = oldCap ? oldCap * 2 : 64;
+        c->entries = realloc(c->entries, sizeof(memo_entry_t) * c->cap);
+        for (int j = c->cap - 1; j >= oldCap; --j) {
+            c->entries[j].fn = NULL;
+            c->entries[j].next = c->free;
+            c->free = j;
+        }
+    }
+
+    // keep about one entry per bucket
+    if (c->count >= c->bucketCap) {
+        c->bucketCap = c->bucketCap ? c->bucketCap * 2 : 64;
+        c->buckets = realloc(c->buckets, sizeof(int) * c->bucketCap);
+        for (int j = 0; j < c->bucketCap; ++j) c->buckets[j] = -1;
+        for (int j = 0; j < c->cap; ++j)
+            if (c->entries[j].fn) memo_link(c, j);
+    }
+
+    int j = c->free;
+    memo_entry_t* m = &c->entries[j];
+    c->free = m->next;
+    m->fn = lval_copy(fn);
+    m->args = malloc(sizeof(lval_t*) * (argc > 0 ? argc : 1));
+    for (int k = 0; k < argc; ++k) m->args[k] = lval_copy(argv[k]);
+    m->argc = argc;
+    m->val = lval_copy(val);
+    m->hash = hash;
+    m->size = size;
+    m->used = 0;
+    memo_link(c, j);
+    c->bytes += size;
+    ++(c->count);
+}
+
+// drop all results kept by current thread
+void memo_shutdown(void) {
+    memo_t* c = &memo_cache;
+    for (int j = 0; j < c->cap; ++j)
+        if (c->entries[j].fn) memo_evict(c, j);
+    free(c->entries);
+    free(c->buckets);
+    c->entries = NULL;
+    c->buckets = NULL;
+    c->cap = c->bucketCap = c->hand = 0;
+    c->free = -1;
+}
+
+/************/
+/* builtins */
+/************/
+
+// memo (apply function to arguments, or hand back kept result)
+lval_t* builtin_memo(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV(argc >= 1, "'memo' function called with too few arguments");
+    LASSERTV(seq_is_fn(argv[0]), "'memo' needs to be passed a function first");
+
+    memo_t* c = &memo_cache;
+    const lval_t* fn = argv[0];
+    unsigned long hash = memo_hash(fn, argc - 1, argv + 1);
+    int j = memo_find(c, hash, fn, argc - 1, argv + 1);
+    if (j >= 0) {
+        ++(c->hits);
+        c->entries[j].used = 1;
+        return lval_copy(c->entries[j].val);
+    }
+    ++(c->misses);
+
+    lval_t** args = malloc(sizeof(lval_t*) * (argc > 1 ? argc - 1 : 1));
+    for (int k = 1; k < argc; ++k) args[k - 1] = lval_copy(argv[k]);
+    lval_t* ret = lval_apply(env, fn, argc - 1, args);
+    free(args);
+
+    // NB: the call may have kept the same result already (recursion)
+    if (ret->type != LVAL_ERR &&
+        memo_find(c, hash, fn, argc - 1, argv + 1) < 0)
+        memo_put(c, hash, fn, argc - 1, argv + 1, ret);
+    return ret;
+}
+
+// memo-cap (set maximum bytes of results kept, returns previous)
+//  NB: 0 drops all results and turns keeping them off
+lval_t* builtin_memo_cap(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "memo-cap");
+    LASSERTV(argv[0]->type == LVAL_NUM && argv[0]->num >= 0,
+             "'memo-cap' needs to be passed a number of bytes");
+
+    long prev = memo_max_bytes;
+    memo_max_bytes = argv[0]->num;
+    memo_make_room(&memo_cache, 0);
+    return lval_num(prev);
+}
+
+// add statistic to map
+void memo_stat(hmap_t* m, const char* name, long val) {
+    hmap_put(m, lval_str(rope_flat(name, strlen(name))), lval_num(val));
+}
+
+// memo-stats (map of statistics of the cache of current thread)
+//  NB: the argument is ignored, e.g. (memo-stats {})
+lval_t* builtin_memo_stats(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "memo-stats");
+
+    const memo_t* c = &memo_cache;
+    hmap_t* m = hmap_new();
+    memo_stat(m, "hits", c->hits);
+    memo_stat(m, "misses", c->misses);
+    memo_stat(m, "evictions", c->evictions);
+    memo_stat(m, "entries", c->count);
+    memo_stat(m, "bytes", c->bytes);
+    memo_stat(m, "cap", memo_max_bytes);
+    return lval_map(m);
+}
@@ -0,0 +1,523 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "core.h"
+#include "expr.h"
+#include "env.h"
+#include "eval.h"
+#include "read.h"
+#include "rope.h"
+#include "hash.h"
+#include "map.h"
+#include "optimize.h"
+#include "files.h"
+#include "deps.h"
+#include "lassert.h"
+
+/**********************************************************/
+/*                   modules and their cache              */
+/*--------------------------------------------------------*/
+/* NB: (load "file") runs every line of a file as if      */
+/*     typed in the repl, on the engine selected for it   */
+/*     and within the budget of the evaluation calling    */
+/*     load (if any), and returns the value of the last   */
+/*     one (or the first error, in which case the         */
+/*     following lines are not run). Files that do not    */
+/*     parse are not run at all. The forms read from a    */
+/*     file are stored next to it, in a file named like   */
+/*     it with a trailing 'c' (".alba" becomes ".albac"), */
+/*     along with a hash of the contents they were read   */
+/*     from. Later loads of the same contents map the     */
+/*     cache into memory and rebuild the forms from it,   */
+/*     without parsing (or even building the parser).     */
+/*     Caches are written to a temporary file renamed     */
+/*     into place, and are ignored if they do not match   */
+/*     the contents, the format or the word size of the   */
+/*     interpreter. Forms are cached as read:             */
+/*     optimization depends on the environment and is     */
+/*     done on every load. Top level defs of loaded files */
+/*     are tracked like those of the repl (see deps.h).   */
+/**********************************************************/
+
+// version of the cache format (bump on any change)
+#define MODULE_VERSION 1
+
+// header of cache file
+typedef struct {
+    char magic[8];     // "ALBAC" padded with NULs
+    uint32_t version;  // MODULE_VERSION
+    uint32_t wordSize; // sizeof(long)
+    uint64_t hash;     // of the contents of the file
+    uint64_t size;     // of the contents of the file
+    uint64_t count;    // number of forms following the header
+} module_header_t;
+
+// parser for files loaded by current thread (built on first cache miss)
+//  NB: one per thread, as actors may load files concurrently
+__thread alba_parser_t* module_parser = NULL;
+
+// evaluation of loaded forms by the engine of the repl (see deps_eval_t)
+//  NB: set by the repl on startup, the tree walker is used until then.
+//      Budgets are not passed: forms loaded by a budgeted evaluation
+//      are charged to it like any nested evaluation (see machine.h)
+deps_eval_t module_engine = NULL;
+const void* module_engine_ctx = NULL;
+
+// hash of contents of file
+uint64_t module_hash(const char* data, long len) {
+    return hash_mix(hash_bytes(0xcbf29ce484222325UL, data, len));
+}
+
+// path of cache of file (to be freed by the caller)
+char* module_cache_path(const char* path) {
+    long len = strlen(path);
+    int alba = len >= 5 && strcmp(path + len - 5, ".alba") == 0;
+    char* ret = malloc(len + 7);
+    strcpy(ret, path);
+    strcat(ret, alba ? "c" : ".albac");
+    return ret;
+}
+
+// free parser of current thread
+void module_shutdown(void) {
+    if (module_parser) alba_free_parser(module_parser);
+    module_parser = NULL;
+}
+
+/*****************/
+/* serialization */
+/*****************/
+
+// growing output buffer
+typedef struct {
+    char* data;
+    long len;
+    long cap;
+    env_t* env;  // registry naming builtins (NULL if none, see image.h)
+} module_out_t;
+
+// append n bytes to buffer
+void module_put(module_out_t* o, const void* p, long n) {
+    if (o->len + n > o->cap) {
+        while (o->len + n > o->cap) o->cap = o->cap ? o->cap * 2 : 4096;
+        o->data = realloc(o->data, o->cap);
+    }
+    memcpy(o->data + o->len, p, n);
+    o->len += n;
+}
+
+// append leaf of rope to buffer
+void module_put_leaf(const char* s, long len, void* ctx) {
+    module_put(ctx, s, len);
+}
+
+// name of builtin in registry, i.e. of its first binding (NULL if none)
+//  NB: builtins bound under several names (e.g. async and spawn) are
+//      all named after the first one, which is bound to the same thing
+const char* module_builtin_name(const env_t* e, const lval_t* v) {
+    for (int j = 0; e && j < e->count; ++j) {
+        const lval_t* b = e->vals[j];
+        if (b->type == LVAL_BUILTIN && b->builtin == v->builtin &&
+            b->builtinv == v->builtinv)
+            return e->syms[j]->sym;
+    }
+    return NULL;
+}
+
+// true if form can be written to buffer
+//  NB: sequences (which may hold running state) cannot be
+int module_can_put(const module_out_t* o, const lval_t* v) {
+    switch (v->type) {
+        case LVAL_NUM: case LVAL_ERR: case LVAL_SYM: case LVAL_STR:
+        case LVAL_VEC:
+            return 1;
+        case LVAL_BUILTIN:
+            return module_builtin_name(o->env, v) != NULL;
+        case LVAL_SEXPR: case LVAL_QEXPR:
+            for (int j = 0; j < v->count; ++j)
+                if (!module_can_put(o, v->cell[j])) return 0;
+            return 1;
+        case LVAL_MAP:
+            for (int j = 0; j < v->map->cap; ++j) {
+                const hmap_slot_t* s = &v->map->slots[j];
+                if (s->key && (!module_can_put(o, s->key) ||
+                               !module_can_put(o, s->val)))
+                    return 0;
+            }
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// append form to buffer
+//  NB: module caches only hold what lval_read produces (errors being
+//      bad numbers), images anything module_can_put accepts
+void module_put_form(module_out_t* o, const lval_t* v) {
+    unsigned char type = v->type;
+    module_put(o, &type, 1);
+
+    switch (v->type) {
+        case LVAL_NUM:
+            module_put(o, &v->num, sizeof(long));
+            break;
+        case LVAL_ERR: case LVAL_SYM: case LVAL_BUILTIN: {
+            const char* s = v->type == LVAL_ERR ? v->err :
+                            v->type == LVAL_SYM ? v->sym :
+                                                  module_builtin_name(o->env, v);
+            uint32_t len = strlen(s);
+            module_put(o, &len, sizeof(len));
+            module_put(o, s, len + 1);
+            break;
+        }
+        case LVAL_STR: {
+            uint64_t len = v->str->len;
+            module_put(o, &len, sizeof(len));
+            rope_each(v->str, &module_put_leaf, o);
+            break;
+        }
+        case LVAL_VEC: {
+            uint32_t len = v->len;
+            module_put(o, &len, sizeof(len));
+            module_put(o, v->vec, sizeof(long) * v->len);
+            break;
+        }
+        case LVAL_SEXPR: case LVAL_QEXPR: {
+            uint32_t count = v->count;
+            module_put(o, &count, sizeof(count));
+            for (int j = 0; j < v->count; ++j)
+                module_put_form(o, v->cell[j]);
+            break;
+        }
+        case LVAL_MAP: {
+            uint32_t count = v->map->count;
+            module_put(o, &count, sizeof(count));
+            for (int j = 0; j < v->map->cap; ++j) {
+                const hmap_slot_t* s = &v->map->slots[j];
+                if (!s->key) continue;
+                module_put_form(o, s->key);
+                module_put_form(o, s->val);
+            }
+            break;
+        }
+        default:
+            assert(0 && "trying to cache form of unknown type");
+    }
+}
+
+// write data to file (returns errno of failure, or 0)
+//  NB: written to a temporary file renamed into place, so that readers
+//      never see a partial file, and a failed write keeps the old one.
+//      Temporary files are named after the process and a counter, as
+//      threads (e.g. actors) may write the same file at once
+int module_write_file(const char* path, const char* data, long len) {
+    static long count = 0;
+    char* tmp = malloc(strlen(path) + 48);
+    sprintf(tmp, "%s.%d.%ld", path, (int) getpid(),
+            __atomic_add_fetch(&count, 1, __ATOMIC_RELAXED));
+
+    int err = 0;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        err = errno;
+    } else {
+        long done = 0, n = 0;
+        while (done < len && (n = write(fd, data + done, len - done)) > 0)
+            done += n;
+        if (done < len) err = n < 0 ? errno : EIO;
+        if (close(fd) < 0 && !err) err = errno;
+        if (!err && rename(tmp, path) < 0) err = errno;
+        if (err) unlink(tmp);
+    }
+    free(tmp);
+    return err;
+}
+
+// write cache of forms read from contents of file
+//  NB: failing to write it (e.g. in a read only directory) is not an
+//      error, the next load just parses the file again
+void module_write_cache(const char* cache, const char* data, long len,
+                        lval_t* const* forms, int count) {
+    module_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "ALBAC", 5);
+    h.version = MODULE_VERSION;
+    h.wordSize = sizeof(long);
+    h.hash = module_hash(data, len);
+    h.size = len;
+    h.count = count;
+
+    module_out_t o = { NULL, 0, 0, NULL };
+    module_put(&o, &h, sizeof(h));
+    for (int j = 0; j < count; ++j) module_put_form(&o, forms[j]);
+
+    module_write_file(cache, o.data, o.len);
+    free(o.data);
+}
+
+/*******************/
+/* deserialization */
+/*******************/
+
+// cursor over cache
+typedef struct {
+    const char* p;
+    const char* end;
+    env_t* env;  // registry naming builtins (NULL if none, see image.h)
+} module_in_t;
+
+// take n bytes from cache (NULL if past its end)
+const char* module_take(module_in_t* in, long n) {
+    if (n < 0 || in->end - in->p < n) return NULL;
+    const char* ret = in->p;
+    in->p += n;
+    return ret;
+}
+
+// read form from cache (NULL if the cache is malformed)
+lval_t* module_get_form(module_in_t* in) {
+    const char* p = module_take(in, 1);
+    if (!p) return NULL;
+
+    switch ((unsigned char) *p) {
+        case LVAL_NUM: {
+            long num;
+            if (!(p = module_take(in, sizeof(long)))) return NULL;
+            memcpy(&num, p, sizeof(long));
+            return lval_num(num);
+        }
+        case LVAL_ERR: case LVAL_SYM: case LVAL_BUILTIN: {
+            int type = (unsigned char) *p;
+            uint32_t len;
+            if (!(p = module_take(in, sizeof(len)))) return NULL;
+            memcpy(&len, p, sizeof(len));
+            if (!(p = module_take(in, (long) len + 1)) || p[len] != '\0')
+                return NULL;
+            if (type == LVAL_ERR) return lval_err((char*) p);
+            if (type == LVAL_SYM) return lval_sym((char*) p);
+
+            // NB: looked up without recording it (see env_get)
+            int slot = in->env ? env_slot(in->env, p) : -1;
+            if (slot < 0 || in->env->vals[slot]->type != LVAL_BUILTIN)
+                return NULL;
+            return lval_copy(in->env->vals[slot]);
+        }
+        case LVAL_STR: {
+            uint64_t len;
+            if (!(p = module_take(in, sizeof(len)))) return NULL;
+            memcpy(&len, p, sizeof(len));
+            if (len > (uint64_t) (in->end - in->p)) return NULL;
+            p = module_take(in, len);
+            return lval_str(rope_flat(p, len));
+        }
+        case LVAL_VEC: {
+            uint32_t len;
+            if (!(p = module_take(in, sizeof(len)))) return NULL;
+            memcpy(&len, p, sizeof(len));
+            if (!(p = module_take(in, sizeof(long) * (long) len))) return NULL;
+            long* vec = len ? malloc(sizeof(long) * len) : NULL;
+            if (len) memcpy(vec, p, sizeof(long) * len);
+            return lval_vec(vec, len);
+        }
+        case LVAL_SEXPR: case LVAL_QEXPR: {
+            lval_t* ret = *p == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+            uint32_t count;
+            if (!(p = module_take(in, sizeof(count)))) {
+                lval_del(ret);
+                return NULL;
+            }
+            memcpy(&count, p, sizeof(count));
+            for (uint32_t j = 0; j < count; ++j) {
+                lval_t* child = module_get_form(in);
+                if (!child) {
+                    lval_del(ret);
+                    return NULL;
+                }
+                lval_add(ret, child);
+            }
+            return ret;
+        }
+        case LVAL_MAP: {
+            uint32_t count;
+            if (!(p = module_take(in, sizeof(count)))) return NULL;
+            memcpy(&count, p, sizeof(count));
+            hmap_t* m = hmap_new();
+            for (uint32_t j = 0; j < count; ++j) {
+                lval_t* key = module_get_form(in);
+                lval_t* val = key ? module_get_form(in) : NULL;
+                if (!val) {
+                    if (key) lval_del(key);
+                    hmap_release(m);
+                    return NULL;
+                }
+                hmap_put(m, key, val);
+            }
+            return lval_map(m);
+        }
+        default:
+            return NULL;
+    }
+}
+
+// forms cached for contents of file (NULL if no valid cache)
+//  NB: the number of forms is stored in count
+lval_t** module_read_cache(const char* cache, const char* data, long len,
+                           int* count) {
+    int fd = open(cache, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (long) sizeof(module_header_t)) {
+        close(fd);
+        return NULL;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    // check header
+    module_header_t h;
+    memcpy(&h, map, sizeof(h));
+    lval_t** forms = NULL;
+    if (memcmp(h.magic, "ALBAC\0\0\0", 8) != 0 ||
+        h.version != MODULE_VERSION || h.wordSize != sizeof(long) ||
+        h.size != (uint64_t) len || h.hash != module_hash(data, len) ||
+        h.count > (uint64_t) st.st_size) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    module_in_t in = { (const char*) map + sizeof(h),
+                       (const char*) map + st.st_size, NULL };
+    forms = malloc(sizeof(lval_t*) * (h.count ? h.count : 1));
+    int n = 0;
+    while (n < (int) h.count && (forms[n] = module_get_form(&in))) ++n;
+    munmap(map, st.st_size);
+
+    // malformed: drop what was read
+    if (n < (int) h.count || in.p != in.end) {
+        while (n--) lval_del(forms[n]);
+        free(forms);
+        return NULL;
+    }
+    *count = n;
+    return forms;
+}
+
+/***********/
+/* parsing */
+/***********/
+
+// read every non blank line of contents into a form
+//  NB: returns the parse error of the first line that has one, if any
+//      (and no forms). Lines are cut in place
+lval_t* module_parse(const char* path, char* data, lval_t*** forms,
+                     int* count) {
+    if (!module_parser) module_parser = alba_new_parser();
+
+    int cap = 16;
+    *forms = malloc(sizeof(lval_t*) * cap);
+    *count = 0;
+
+    char* line = data;
+    while (line) {
+        char* end = strchr(line, '\n');
+        if (end) *end = '\0';
+
+        if (line[strspn(line, " \t\r")]) {
+            mpc_result_t r;
+            if (!mpc_parse(path, line, module_parser->program, &r)) {
+                char* msg = mpc_err_string(r.error);
+                msg[strcspn(msg, "\n")] = '\0';
+                lval_t* err = lval_err(msg);
+                free(msg);
+                mpc_err_delete(r.error);
+                while ((*count)--) lval_del((*forms)[*count]);
+                free(*forms);
+                *forms = NULL;
+                *count = 0;
+                return err;
+            }
+            if (*count == cap) {
+                cap *= 2;
+                *forms = realloc(*forms, sizeof(lval_t*) * cap);
+            }
+            (*forms)[(*count)++] = lval_read(r.output);
+            mpc_ast_delete(r.output);
+        }
+        line = end ? end + 1 : NULL;
+    }
+    return NULL;
+}
+
+/************/
+/* builtins */
+/************/
+
+// evaluate form of loaded file (see deps_eval_t)
+lval_t* module_eval(env_t* e, lval_t* form, const void* ctx) {
+    form = lval_optimize(e, form);
+    if (module_engine) return module_engine(e, form, module_engine_ctx);
+    return lval_eval(e, form);
+}
+
+// load (run lines of file, from its cache if up to date)
+lval_t* builtin_load(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "load");
+    LASSERTV_TYPES(argv, LVAL_STR, "load");
+
+    // path as a C string
+    long pathLen = argv[0]->str->len;
+    char* path = malloc(pathLen + 1);
+    rope_copy_chars(argv[0]->str, 0, pathLen, path);
+    path[pathLen] = '\0';
+
+    const char* paths[1] = { path };
+    files_buf_t* buf = files_read_all(paths, 1);
+    if (!buf->data) {
+        char msg[512];
+        snprintf(msg, sizeof(msg), "cannot load %s: %s", path,
+                 strerror(buf->err));
+        free(buf);
+        free(path);
+        return lval_err(msg);
+    }
+
+    // cached forms, or forms parsed and then cached
+    char* cache = module_cache_path(path);
+    int count = 0;
+    lval_t** forms = module_read_cache(cache, buf->data, buf->len, &count);
+    lval_t* ret = NULL;
+    if (!forms) {
+        char* data = malloc(buf->len + 1);
+        memcpy(data, buf->data, buf->len + 1);
+        ret = module_parse(path, data, &forms, &count);
+        if (!ret)
+            module_write_cache(cache, buf->data, buf->len, forms, count);
+        free(data);
+    }
+    free(cache);
+    free(buf->data);
+    free(buf);
+    free(path);
+    if (ret) return ret;
+
+    // run forms, stopping at the first error
+    ret = lval_sexpr();
+    int j = 0;
+    for (; j < count; ++j) {
+        lval_del(ret);
+        ret = deps_eval(env, forms[j], &module_eval, NULL);
+        if (ret->type == LVAL_ERR) break;
+    }
+    while (++j < count) lval_del(forms[j]);
+    free(forms);
+    return ret;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "core.h"
+#include "expr.h"
+#include "env.h"
+#include "eval.h"
+#include "builtin.h"
+
+/**********************************************************/
+/*           constant folding / partial evaluation        */
+/*--------------------------------------------------------*/
+/* NB: run on top level forms right before they are      */
+/*     evaluated (every time, see deps.h). Calls to pure  */
+/*     builtins with constant arguments are replaced by   */
+/*     their value and evals of literal q-expressions are */
+/*     inlined. Nested + and * calls are not flattened,   */
+/*     as (+ -1 (+ m 1)) has to overflow like it does     */
+/*     without optimizing.                                */
+/*     Folding relies on the bindings of the environment  */
+/*     when the form runs, so q-expressions (which are    */
+/*     data, and may run again after names are rebound)   */
+/*     are left untouched, even when compiled (see        */
+/*     closure.h).                                        */
+/**********************************************************/
+
+// builtin bound to head symbol of s-expression (NULL if none)
+lval_t* opt_callee(env_t* e, const lval_t* v) {
+    if (v->type != LVAL_SEXPR || v->count < 1 ||
+        v->cell[0]->type != LVAL_SYM)
+        return NULL;
+
+    lval_t* f = env_get(e, v->cell[0]->sym);
+    return f && f->type == LVAL_BUILTIN ? f : NULL;
+}
+
+// true if lval evaluates to itself and may replace a folded call
+int opt_is_const(const lval_t* v) {
+    return v->type == LVAL_NUM || v->type == LVAL_QEXPR ||
+           v->type == LVAL_VEC || v->type == LVAL_STR ||
+           v->type == LVAL_MAP || v->type == LVAL_SEQ;
+}
+
+// optimize lval (consumed), setting changed if the result differs
+//  NB: compiled forms cached on unchanged s-expressions stay valid
+lval_t* opt_form(env_t* e, lval_t* v, int* changed) {
+    if (v->type != LVAL_SEXPR) return v;
+
+    // optimize children first
+    int inner = 0;
+    for (int j = 0; j < v->count; ++j)
+        v->cell[j] = opt_form(e, v->cell[j], &inner);
+    if (inner) {
+        lval_detach(v);
+        *changed = 1;
+    }
+
+    // 1 element: eliminate parentheses around constants
+    if (v->count == 1 && opt_is_const(v->cell[0])) {
+        *changed = 1;
+        return lval_take(v, 0);
+    }
+
+    lval_t* f = opt_callee(e, v);
+    if (!f) return v;
+
+    // eval of literal q-expression: inline it
+    if (f->builtin == &builtin_eval && v->count == 2 &&
+        v->cell[1]->type == LVAL_QEXPR && v->cell[1]->count > 0) {
+        *changed = 1;
+        lval_t* body = lval_take(v, 1);
+        lval_detach(body);
+        body->type = LVAL_SEXPR;
+        return opt_form(e, body, changed);
+    }
+
+    if (!f->pure) return v;
+
+    // fold calls with constant arguments
+    for (int j = 1; j < v->count; ++j)
+        if (!opt_is_const(v->cell[j])) return v;
+
+    lval_t* ret = lval_eval(e, lval_copy(v));
+    if (!opt_is_const(ret)) {
+        // errors (and non-constant results) are left to runtime
+        lval_del(ret);
+        return v;
+    }
+
+    *changed = 1;
+    lval_del(v);
+    return ret;
+}
+
+// optimize lval (consumed)
+lval_t* lval_optimize(env_t* e, lval_t* v) {
+    int changed = 0;
+    return opt_form(e, v, &changed);
+}
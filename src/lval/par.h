@@ -0,0 +1,395 @@
+#pragma once
+
+#include <limits.h>
+
+#include "core.h"
+#include "expr.h"
+#include "env.h"
+#include "eval.h"
+#include "seq.h"
+#include "vec.h"
+#include "pool.h"
+#include "machine.h"
+#include "optimize.h"
+#include "lassert.h"
+
+/**********************************************************/
+/*                  parallel builtins                     */
+/*--------------------------------------------------------*/
+/* NB: pmap, preduce and pfor split the elements of a     */
+/*     sequence into chunks run as tasks on the shared    */
+/*     thread pool (see pool.h). lvals are not safe to    */
+/*     share between threads, so every thread works on    */
+/*     its own clone of the environment and function (see */
+/*     lval_clone) and on clones of the elements. As a    */
+/*     consequence definitions made by the function only  */
+/*     last for the call, and are not seen by the caller. */
+/*     Results are always put back in element order.      */
+/**********************************************************/
+
+// operations
+typedef enum {
+    PAR_MAP,
+    PAR_REDUCE,
+    PAR_FOR
+} par_op_t;
+
+// environment and function of one thread
+typedef struct {
+    env_t* env;
+    lval_t* fn;
+} par_slot_t;
+
+// parallel call
+typedef struct {
+    par_op_t op;
+    env_t* env;          // caller's (only read to clone it)
+    const lval_t* fn;    // caller's (only read to clone it)
+    const lval_t* init;  // preduce: identity of fn
+    lval_t** items;
+    lval_t** results;    // one per element (map, for) or chunk (reduce)
+    int count;
+    int chunk;
+    par_slot_t* slots;   // one per pool deque (see pool_deques)
+    int budgeted;        // run with a budget (see machine_budget)
+    long budget;         // steps left, shared by chunks (may go negative)
+} par_job_t;
+
+// chunk of a parallel call
+typedef struct {
+    par_job_t* job;
+    int index;
+} par_task_t;
+
+// shared pool
+//  NB: selects vector kernels first, so that threads do not race for it
+pool_t* par_pool(void) {
+    vec_kernels();
+    return pool_get();
+}
+
+// slot of current thread, cloning environment and function on first use
+//  NB: only the owning thread touches a slot, and the caller does not
+//      modify env or fn until every task is done
+par_slot_t* par_slot(par_job_t* job, pool_t* p) {
+    par_slot_t* s = &job->slots[pool_own(p)];
+    if (!s->env) {
+        s->env = env_clone(job->env);
+        s->fn = lval_clone(job->fn);
+    }
+    return s;
+}
+
+// run chunk of parallel call
+void par_chunk(par_task_t* t) {
+    par_job_t* job = t->job;
+    par_slot_t* s = par_slot(job, pool_get());
+
+    int from = t->index * job->chunk;
+    int to = from + job->chunk < job->count ? from + job->chunk : job->count;
+
+    // reduce: fold chunk from identity
+    if (job->op == PAR_REDUCE) {
+        lval_t* acc = lval_clone(job->init);
+        for (int j = from; j < to && acc->type != LVAL_ERR; ++j) {
+            lval_t* args[2] = { acc, lval_clone(job->items[j]) };
+            acc = lval_apply(s->env, s->fn, 2, args);
+        }
+        job->results[t->index] = acc;
+        return;
+    }
+
+    // map and for: apply to each element, stopping at the first error
+    for (int j = from; j < to; ++j) {
+        lval_t* arg = lval_clone(job->items[j]);
+        lval_t* ret = lval_apply(s->env, s->fn, 1, &arg);
+        if (ret->type == LVAL_ERR || job->op == PAR_MAP) {
+            job->results[j] = ret;
+            if (ret->type == LVAL_ERR) break;
+        } else {
+            lval_del(ret);
+        }
+    }
+}
+
+// run chunk of parallel call, drawing steps from the budget of the job
+//  NB: whichever thread runs it, the caller's included (see par_call)
+void par_run(void* arg) {
+    par_job_t* job = ((par_task_t*) arg)->job;
+    long outer = machine_budget;
+    long* shared = machine_shared;
+    machine_budget = job->budgeted ? LONG_MAX : -1;
+    machine_shared = job->budgeted ? &job->budget : NULL;
+    par_chunk(arg);
+    machine_budget = outer;
+    machine_shared = shared;
+}
+
+// run parallel call over the elements of seq and fill job->results
+//  NB: returns an error (or NULL if all went well), and never returns
+//      for infinite sequences, as elements are collected first
+lval_t* par_call(par_job_t* job, env_t* env, const lval_t* seq) {
+    seq_t* s = seq_of(seq);
+    if (!s) return lval_err("parallel builtins need to be passed a sequence");
+
+    // collect elements on the calling thread
+    //  NB: lazy stages may run functions, which is only safe here
+    int cap = 16;
+    job->items = malloc(sizeof(lval_t*) * cap);
+    job->count = 0;
+    seq_iter_t* it = seq_iter_new(s);
+    lval_t* x;
+    while ((x = seq_iter_next(env, it))) {
+        if (x->type == LVAL_ERR) {
+            for (int j = 0; j < job->count; ++j) lval_del(job->items[j]);
+            free(job->items);
+            seq_iter_del(it);
+            seq_release(s);
+            return x;
+        }
+        if (job->count == cap) {
+            cap *= 2;
+            job->items = realloc(job->items, sizeof(lval_t*) * cap);
+        }
+        job->items[job->count++] = x;
+    }
+    seq_iter_del(it);
+    seq_release(s);
+
+    pool_t* p = par_pool();
+
+    // a few chunks per thread, so that idle threads can steal some
+    int threads = p->count + 1;
+    job->chunk = job->count / (threads * 4);
+    if (job->chunk < 1) job->chunk = 1;
+    int tasks = (job->count + job->chunk - 1) / job->chunk;
+
+    job->env = env;
+    long start = machine_left();
+    job->budgeted = start >= 0;
+    job->budget = start;
+    job->results = calloc(job->count ? job->count : 1, sizeof(lval_t*));
+    job->slots = calloc(pool_deques(p), sizeof(par_slot_t));
+
+    par_task_t* ts = malloc(sizeof(par_task_t) * (tasks ? tasks : 1));
+    void** args = malloc(sizeof(void*) * (tasks ? tasks : 1));
+    for (int j = 0; j < tasks; ++j) {
+        ts[j] = (par_task_t){ job, j };
+        args[j] = &ts[j];
+    }
+    pool_run(p, &par_run, args, tasks);
+    if (job->budgeted) {
+        // steps the chunks drew are charged to the caller
+        long left = __atomic_load_n(&job->budget, __ATOMIC_RELAXED);
+        machine_spend(left > 0 ? start - left : start);
+    }
+    free(args);
+    free(ts);
+
+    // slots are freed here, as they were all made by other threads
+    //  NB: lvals of other threads end up in this thread's free list
+    for (int j = 0; j < pool_deques(p); ++j) {
+        if (job->slots[j].env) {
+            env_del(job->slots[j].env);
+            lval_del(job->slots[j].fn);
+        }
+    }
+    free(job->slots);
+    return NULL;
+}
+
+// free elements and results of parallel call
+void par_free(par_job_t* job, int results) {
+    for (int j = 0; j < job->count; ++j) lval_del(job->items[j]);
+    for (int j = 0; j < results; ++j)
+        if (job->results[j]) lval_del(job->results[j]);
+    free(job->items);
+    free(job->results);
+}
+
+// first error among n results (taken from results, NULL if none)
+lval_t* par_error(par_job_t* job, int n) {
+    for (int j = 0; j < n; ++j) {
+        if (job->results[j] && job->results[j]->type == LVAL_ERR) {
+            lval_t* err = job->results[j];
+            job->results[j] = NULL;
+            return err;
+        }
+    }
+    return NULL;
+}
+
+/************/
+/* builtins */
+/************/
+
+// pmap (apply function to all elements in parallel)
+//  NB: results of mapping over a vector are a vector if all numbers
+lval_t* builtin_pmap(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 2, 2, "pmap");
+    LASSERTV(seq_is_fn(argv[0]), "'pmap' needs to be passed a function first");
+
+    par_job_t job = { PAR_MAP, env, argv[0], NULL };
+    lval_t* err = par_call(&job, env, argv[1]);
+    if (err) return err;
+
+    lval_t* ret = par_error(&job, job.count);
+    int nums = argv[1]->type == LVAL_VEC;
+    for (int j = 0; !ret && nums && j < job.count; ++j)
+        nums = job.results[j]->type == LVAL_NUM;
+
+    if (!ret && nums) {
+        long* vec = malloc(sizeof(long) * (job.count > 0 ? job.count : 1));
+        for (int j = 0; j < job.count; ++j) vec[j] = job.results[j]->num;
+        ret = lval_vec(vec, job.count);
+    } else if (!ret) {
+        ret = lval_qexpr();
+        for (int j = 0; j < job.count; ++j) {
+            lval_add(ret, job.results[j]);
+            job.results[j] = NULL;
+        }
+    }
+
+    par_free(&job, job.count);
+    return ret;
+}
+
+// preduce (fold elements in parallel chunks, then fold the chunks)
+//  NB: function needs to be associative and init its identity, as
+//      every chunk is folded starting from init
+lval_t* builtin_preduce(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 3, 3, "preduce");
+    LASSERTV(seq_is_fn(argv[0]),
+             "'preduce' needs to be passed a function first");
+
+    par_job_t job = { PAR_REDUCE, env, argv[0], argv[1] };
+    lval_t* err = par_call(&job, env, argv[2]);
+    if (err) return err;
+
+    int chunks = job.count ? (job.count + job.chunk - 1) / job.chunk : 0;
+    lval_t* acc = par_error(&job, chunks);
+    if (!acc) {
+        acc = lval_copy(argv[1]);
+        for (int j = 0; j < chunks && acc->type != LVAL_ERR; ++j) {
+            lval_t* args[2] = { acc, job.results[j] };
+            job.results[j] = NULL;
+            acc = lval_apply(env, argv[0], 2, args);
+        }
+    }
+
+    par_free(&job, chunks);
+    return acc;
+}
+
+// pfor (apply function to all elements in parallel, for side effects)
+lval_t* builtin_pfor(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 2, 2, "pfor");
+    LASSERTV(seq_is_fn(argv[0]), "'pfor' needs to be passed a function first");
+
+    par_job_t job = { PAR_FOR, env, argv[0], NULL };
+    lval_t* err = par_call(&job, env, argv[1]);
+    if (err) return err;
+
+    lval_t* ret = par_error(&job, job.count);
+    par_free(&job, job.count);
+    return ret ? ret : lval_sexpr();
+}
+
+/*************************/
+/* parallel s-expression */
+/*************************/
+
+// default minimum cost of arguments evaluated in parallel
+#ifndef PAR_DEFAULT_COST
+#define PAR_DEFAULT_COST 4096
+#endif
+
+// minimum estimated cost of arguments evaluated in parallel
+//  NB: 0 disables parallel evaluation of arguments (see --par)
+long par_min_cost = 0;
+
+// estimated cost of evaluating argument v on another thread
+//  NB: -1 if it cannot be. Only literal numbers, vectors and strings,
+//      symbols bound to those (or to builtins) and calls to pure
+//      builtins qualify: evaluating them only reads the environment
+//      and copying their values does not write to shared lvals.
+//      Every node costs 1 and vectors and strings their length.
+long par_cost(env_t* e, const lval_t* v) {
+    switch (v->type) {
+        case LVAL_NUM: return 1;
+        case LVAL_VEC: return 1 + v->len;
+        case LVAL_STR: return 1 + v->str->len;
+        case LVAL_SYM: {
+            const lval_t* val = env_get(e, v->sym);
+            if (!val) return -1;
+            if (val->type == LVAL_NUM || val->type == LVAL_BUILTIN) return 1;
+            return val->type == LVAL_VEC || val->type == LVAL_STR ?
+                par_cost(e, val) : -1;
+        }
+        case LVAL_SEXPR: {
+            const lval_t* f = opt_callee(e, v);
+            if (!f || !f->pure || v->count < 2) return -1;
+            long cost = 1;
+            for (int j = 1; j < v->count; ++j) {
+                long c = par_cost(e, v->cell[j]);
+                if (c < 0) return -1;
+                cost += c;
+            }
+            return cost;
+        }
+        default:
+            return -1;
+    }
+}
+
+// argument of s-expression evaluated as a task
+typedef struct {
+    env_t* env;
+    lval_t** cell;
+} par_arg_t;
+
+// evaluate argument in place
+void par_arg_run(void* arg) {
+    par_arg_t* a = arg;
+    *a->cell = lval_eval(a->env, *a->cell);
+}
+
+// evaluate all elements of pure call v in place, the expensive ones in
+// parallel
+//  NB: returns 0 (evaluating nothing) unless v calls a pure builtin
+//      with at least two arguments costing par_min_cost or more
+int par_eval_args(env_t* e, lval_t* v) {
+    if (par_cost(e, v) < 0) return 0;
+
+    int n = 0;
+    long* costs = malloc(sizeof(long) * v->count);
+    for (int j = 0; j < v->count; ++j) {
+        costs[j] = j > 0 ? par_cost(e, v->cell[j]) : 0;
+        if (costs[j] >= par_min_cost) ++n;
+    }
+    if (n < 2) {
+        free(costs);
+        return 0;
+    }
+
+    // cheap elements are evaluated right away, the others as tasks
+    //  NB: v has no side effects, so the order does not matter
+    par_arg_t* args = malloc(sizeof(par_arg_t) * n);
+    void** tasks = malloc(sizeof(void*) * n);
+    n = 0;
+    for (int j = 0; j < v->count; ++j) {
+        if (costs[j] < par_min_cost) {
+            v->cell[j] = lval_eval(e, v->cell[j]);
+        } else {
+            args[n] = (par_arg_t){ e, &v->cell[j] };
+            tasks[n] = &args[n];
+            ++n;
+        }
+    }
+    pool_run(par_pool(), &par_arg_run, tasks, n);
+
+    free(tasks);
+    free(args);
+    free(costs);
+    return 1;
+}
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <assert.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+/**********************************************************/
+/*               work-stealing thread pool                */
+/*--------------------------------------------------------*/
+/* NB: every worker owns a deque of tasks: it pushes and  */
+/*     pops its own tasks at the back, while idle workers */
+/*     steal from the front of the others'. Threads that  */
+/*     are not workers (the repl, actors) borrow one of   */
+/*     POOL_GUESTS more deques while they wait for tasks, */
+/*     so that every thread running tasks owns a deque    */
+/*     (and thus a slot of parallel calls, see par.h) of  */
+/*     its own. A thread waiting for its tasks (pool_run) */
+/*     keeps running tasks in the meantime, so tasks may  */
+/*     start other tasks and wait for them without        */
+/*     deadlocking. The pool is sized to the number of    */
+/*     cores (or to ALBA_THREADS, counting the thread     */
+/*     calling it).                                       */
+/**********************************************************/
+
+// number of deques lent to threads that are not workers
+#ifndef POOL_GUESTS
+#define POOL_GUESTS 16
+#endif
+
+// task function
+typedef void (*pool_fn_t)(void* arg);
+
+// group of tasks waited for together
+typedef struct {
+    int pending;
+} pool_job_t;
+
+// task
+typedef struct {
+    pool_fn_t fn;
+    void* arg;
+    pool_job_t* job;
+} pool_task_t;
+
+// deque of tasks (ring buffer)
+typedef struct {
+    pthread_mutex_t lock;
+    pool_task_t* tasks;
+    int head; // front: stolen from
+    int count;
+    int cap;
+} pool_deque_t;
+
+// thread pool
+typedef struct {
+    int count;             // number of workers
+    pthread_t* threads;
+    pool_deque_t* deques;  // one per worker, then POOL_GUESTS for others
+    int guests[POOL_GUESTS]; // guest deques lent (protected by lock)
+    pthread_mutex_t lock;  // protects sleeping and guests
+    pthread_cond_t wake;
+    pthread_cond_t returned; // a guest deque was given back
+    int queued;            // tasks in all deques
+    int started;           // workers that took their deque
+    int stop;
+} pool_t;
+
+// index of deque owned by current thread (-1 if none)
+//  NB: threads that are not workers own one while in pool_run
+__thread int pool_self = -1;
+
+/**********/
+/* deques */
+/**********/
+
+// push task at the back of deque
+void pool_deque_push(pool_deque_t* d, pool_task_t t) {
+    pthread_mutex_lock(&d->lock);
+    if (d->count == d->cap) {
+        int cap = d->cap ? d->cap * 2 : 64;
+        pool_task_t* tasks = malloc(sizeof(pool_task_t) * cap);
+        for (int j = 0; j < d->count; ++j)
+            tasks[j] = d->tasks[(d->head + j) % d->cap];
+        free(d->tasks);
+        d->tasks = tasks;
+        d->head = 0;
+        d->cap = cap;
+    }
+    d->tasks[(d->head + d->count) % d->cap] = t;
+    __atomic_store_n(&d->count, d->count + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&d->lock);
+}
+
+// take task from the back (own) or front (steal) of deque
+//  NB: returns 0 if the deque is empty
+int pool_deque_take(pool_deque_t* d, int steal, pool_task_t* out) {
+    // cheap check without locking
+    if (__atomic_load_n(&d->count, __ATOMIC_RELAXED) == 0) return 0;
+
+    int ok = 0;
+    pthread_mutex_lock(&d->lock);
+    if (d->count > 0) {
+        if (steal) {
+            *out = d->tasks[d->head];
+            d->head = (d->head + 1) % d->cap;
+        } else {
+            *out = d->tasks[(d->head + d->count - 1) % d->cap];
+        }
+        __atomic_store_n(&d->count, d->count - 1, __ATOMIC_RELAXED);
+        ok = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+/*********/
+/* tasks */
+/*********/
+
+// number of deques of pool
+int pool_deques(const pool_t* p) {
+    return p->count + POOL_GUESTS;
+}
+
+// deque of current thread
+//  NB: only called by threads running tasks, which all own one
+int pool_own(const pool_t* p) {
+    assert(pool_self >= 0 && "thread running tasks without a deque");
+    return pool_self;
+}
+
+// find task to run, first in own deque then in the others'
+int pool_find(pool_t* p, pool_task_t* out) {
+    int own = pool_own(p);
+    if (pool_deque_take(&p->deques[own], 0, out)) goto found;
+
+    int n = pool_deques(p);
+    for (int j = 1; j < n; ++j)
+        if (pool_deque_take(&p->deques[(own + j) % n], 1, out))
+            goto found;
+    return 0;
+
+found:
+    __atomic_sub_fetch(&p->queued, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+// run task and mark it done
+void pool_exec(pool_task_t* t) {
+    t->fn(t->arg);
+    __atomic_sub_fetch(&t->job->pending, 1, __ATOMIC_RELEASE);
+}
+
+// worker thread
+void lval_freelist_drain(void); // forward declarations
+void memo_shutdown(void);
+void deps_shutdown(void);
+void module_shutdown(void);
+void* pool_worker(void* arg) {
+    pool_t* p = arg;
+
+    pthread_mutex_lock(&p->lock);
+    pool_self = p->started++;
+    pthread_mutex_unlock(&p->lock);
+
+    while (1) {
+        pool_task_t t;
+        if (pool_find(p, &t)) {
+            pool_exec(&t);
+            continue;
+        }
+
+        // sleep until more tasks are queued
+        pthread_mutex_lock(&p->lock);
+        while (!p->stop && __atomic_load_n(&p->queued, __ATOMIC_RELAXED) == 0)
+            pthread_cond_wait(&p->wake, &p->lock);
+        int stop = p->stop;
+        pthread_mutex_unlock(&p->lock);
+        if (stop) break;
+    }
+
+    memo_shutdown();
+    deps_shutdown();
+    module_shutdown();
+    lval_freelist_drain();
+    return NULL;
+}
+
+/********/
+/* pool */
+/********/
+
+// create pool with given number of workers
+pool_t* pool_new(int count) {
+    pool_t* p = malloc(sizeof(pool_t));
+    p->count = count;
+    p->threads = malloc(sizeof(pthread_t) * (count ? count : 1));
+    p->deques = calloc(pool_deques(p), sizeof(pool_deque_t));
+    for (int j = 0; j < pool_deques(p); ++j)
+        pthread_mutex_init(&p->deques[j].lock, NULL);
+    for (int j = 0; j < POOL_GUESTS; ++j)
+        p->guests[j] = 0;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    pthread_cond_init(&p->returned, NULL);
+    p->queued = 0;
+    p->started = 0;
+    p->stop = 0;
+
+    for (int j = 0; j < count; ++j)
+        pthread_create(&p->threads[j], NULL, &pool_worker, p);
+    return p;
+}
+
+// stop workers and free pool
+//  NB: no task can be running
+void pool_del(pool_t* p) {
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+
+    for (int j = 0; j < p->count; ++j)
+        pthread_join(p->threads[j], NULL);
+    for (int j = 0; j < pool_deques(p); ++j) {
+        pthread_mutex_destroy(&p->deques[j].lock);
+        free(p->deques[j].tasks);
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->wake);
+    pthread_cond_destroy(&p->returned);
+    free(p->deques);
+    free(p->threads);
+    free(p);
+}
+
+// borrow guest deque, waiting for one to be given back if need be
+int pool_guest_take(pool_t* p) {
+    pthread_mutex_lock(&p->lock);
+    int j = 0;
+    while (1) {
+        for (j = 0; j < POOL_GUESTS && p->guests[j]; ++j);
+        if (j < POOL_GUESTS) break;
+        pthread_cond_wait(&p->returned, &p->lock);
+    }
+    p->guests[j] = 1;
+    pthread_mutex_unlock(&p->lock);
+    return p->count + j;
+}
+
+// give back guest deque (empty by then)
+void pool_guest_give(pool_t* p, int own) {
+    pthread_mutex_lock(&p->lock);
+    p->guests[own - p->count] = 0;
+    pthread_cond_signal(&p->returned);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// run n tasks of fn on args[j] and wait for all of them
+//  NB: the calling thread runs tasks too while waiting
+void pool_run(pool_t* p, pool_fn_t fn, void** args, int n) {
+    // threads that are not workers borrow a deque for the outermost call
+    //  NB: it is empty again once all of its tasks are done
+    int guest = pool_self < 0;
+    if (guest) pool_self = pool_guest_take(p);
+
+    pool_job_t job = { n };
+    pool_deque_t* own = &p->deques[pool_own(p)];
+
+    // push in reverse, so that the owner starts from the first
+    for (int j = n - 1; j >= 0; --j)
+        pool_deque_push(own, (pool_task_t){ fn, args[j], &job });
+
+    pthread_mutex_lock(&p->lock);
+    __atomic_add_fetch(&p->queued, n, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+
+    while (__atomic_load_n(&job.pending, __ATOMIC_ACQUIRE) > 0) {
+        pool_task_t t;
+        if (pool_find(p, &t)) pool_exec(&t);
+        else                  sched_yield();
+    }
+
+    if (guest) {
+        pool_guest_give(p, pool_self);
+        pool_self = -1;
+    }
+}
+
+// number of threads to run with (including the calling one)
+int pool_threads(void) {
+    const char* env = getenv("ALBA_THREADS");
+    int n = env ? atoi(env) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+// shared pool (created on first use)
+//  NB: created under a lock, as actors may ask for it at the same time
+pool_t* pool_global = NULL;
+pthread_mutex_t pool_global_lock = PTHREAD_MUTEX_INITIALIZER;
+pool_t* pool_get(void) {
+    pool_t* p = __atomic_load_n(&pool_global, __ATOMIC_ACQUIRE);
+    if (p) return p;
+
+    pthread_mutex_lock(&pool_global_lock);
+    if (!pool_global)
+        __atomic_store_n(&pool_global, pool_new(pool_threads() - 1),
+                         __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&pool_global_lock);
+    return pool_global;
+}
+
+// free shared pool (if created)
+void pool_shutdown(void) {
+    if (pool_global) pool_del(pool_global);
+    pool_global = NULL;
+}
@@ -2,11 +2,56 @@
 
 #include "core.h"
 #include "env.h"
+#include "rope.h"
+#include "map.h"
 
 /********/
 /* lval */
 /********/
 
+// print vector lval
+void lval_print_vec(const lval_t* v) {
+    putchar('[');
+    for (int j = 0; j < v->len; ++j)
+        printf(j ? " %li" : "%li", v->vec[j]);
+    putchar(']');
+}
+
+// print characters of string, escaped
+void lval_print_chars(const char* s, long len, void* ctx) {
+    for (long j = 0; j < len; ++j) {
+        switch (s[j]) {
+            case '"' : fputs("\\\"", stdout); break;
+            case '\\': fputs("\\\\", stdout); break;
+            case '\n': fputs("\\n",  stdout); break;
+            case '\t': fputs("\\t",  stdout); break;
+            default  : putchar(s[j]);          break;
+        }
+    }
+}
+
+// print string lval
+void lval_print_str(const lval_t* v) {
+    putchar('"');
+    rope_each(v->str, &lval_print_chars, NULL);
+    putchar('"');
+}
+
+// print map lval
+void lval_print(const lval_t*); // forward declaration
+void lval_print_map(const lval_t* v) {
+    fputs("#{", stdout);
+    int first = 1;
+    for (int j = 0; j < v->map->cap; ++j) {
+        const hmap_slot_t* s = &v->map->slots[j];
+        if (!s->key) continue;
+        if (!first) fputs(", ", stdout);
+        lval_print(s->key); putchar(' '); lval_print(s->val);
+        first = 0;
+    }
+    putchar('}');
+}
+
 // print atomic lval
 void lval_print_expr(const lval_t*, char, char); // forward declaration
 void lval_print(const lval_t* v) {
@@ -19,6 +64,11 @@ void lval_print(const lval_t* v) {
         case LVAL_BUILTIN : printf("<builtin>");         break;
         case LVAL_SEXPR   : lval_print_expr(v, '(', ')'); break;
         case LVAL_QEXPR   : lval_print_expr(v, '{', '}'); break;
+        case LVAL_VEC     : lval_print_vec(v);            break;
+        case LVAL_STR     : lval_print_str(v);            break;
+        case LVAL_MAP     : lval_print_map(v);            break;
+        case LVAL_SEQ     : printf("<seq>");             break;
+        case LVAL_TAIL    : printf("<tail>");            break;
         default           : assert(0 && "trying to print lval of unknown type");
     }
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "core.h"
+#include "rope.h"
 
 // read ast node into an lval
 lval_t* lval_read_num(const mpc_ast_t* tree) {
@@ -12,8 +13,67 @@ lval_t* lval_read_num(const mpc_ast_t* tree) {
                              lval_err("invalid number");
 }
 
-// turn ast into lval
-lval_t* lval_read(const mpc_ast_t* tree) {
+// read vector literal ast node into an lval
+lval_t* lval_read_vec(const mpc_ast_t* tree) {
+    long* vec = tree->children_num ? malloc(sizeof(long) * tree->children_num) :
+                                     NULL;
+    int len = 0;
+    for (int j = 0; j < tree->children_num; ++j) {
+        const mpc_ast_t* child = tree->children[j];
+        if (!strstr(child->tag, "number")) continue;
+
+        errno = 0;
+        vec[len++] = strtol(child->contents, NULL, 10);
+        if (errno == ERANGE) {
+            free(vec);
+            return lval_err("invalid number");
+        }
+    }
+
+    if (len == 0) { free(vec); vec = NULL; }
+    return lval_vec(vec, len);
+}
+
+// read string literal ast node into an lval
+//  NB: literals without escapes share the characters of src (the buffer
+//      holding input, the text the ast was parsed from, if any) instead
+//      of copying them
+lval_t* lval_read_str(const mpc_ast_t* tree, rope_buf_t* src,
+                      const char* input) {
+    const char* lit = tree->contents;
+    long len = strlen(lit) - 2;
+
+    if (!strchr(lit, '\\')) {
+        // NB: positions count from the start of input, not of src
+        const char* at = input ? input + tree->state.pos : NULL;
+        if (src && at && memcmp(at, lit, len + 2) == 0)
+            return lval_str(rope_leaf(src, at + 1, len));
+        return lval_str(rope_flat(lit + 1, len));
+    }
+
+    // unescape
+    char* buf = malloc(len);
+    long n = 0;
+    for (long j = 1; j <= len; ++j) {
+        char c = lit[j];
+        if (c == '\\') {
+            switch (lit[++j]) {
+                case 'n': c = '\n';    break;
+                case 't': c = '\t';    break;
+                default : c = lit[j]; break;
+            }
+        }
+        buf[n++] = c;
+    }
+    lval_t* ret = lval_str(rope_flat(buf, n));
+    free(buf);
+    return ret;
+}
+
+// turn ast parsed from input (held by src) into lval
+//  NB: src and input may be NULL if the input is not kept around
+lval_t* lval_read_src(const mpc_ast_t* tree, rope_buf_t* src,
+                      const char* input) {
     // check NULL
     assert(tree && "Reading null ast into lval");
 
@@ -25,6 +85,15 @@ lval_t* lval_read(const mpc_ast_t* tree) {
     else if (strstr(tree->tag, "symbol"))
         return lval_sym(tree->contents);
 
+    // process string literal
+    else if (strstr(tree->tag, "string"))
+        return lval_read_str(tree, src, input);
+
+    // process vector literal
+    //  NB: needs to come before exprs, as its tag contains "expr"
+    else if (strstr(tree->tag, "vector"))
+        return lval_read_vec(tree);
+
     // process sexpr OR root of program (treated equally for now)
     else if (strcmp(tree->tag, ">") == 0 ||
              strstr(tree->tag, "expr")) {
@@ -40,7 +109,7 @@ lval_t* lval_read(const mpc_ast_t* tree) {
             if (strcmp(child->contents, "}") == 0) continue;
             if (strcmp(child->tag,  "regex") == 0) continue;
             // read and add child to sexpr
-            lval_add(ret, lval_read(child));
+            lval_add(ret, lval_read_src(child, src, input));
         }
         // return
         return ret;
@@ -50,3 +119,8 @@ lval_t* lval_read(const mpc_ast_t* tree) {
     else
         assert(0 && "trying to read malformed ast into lval");
 }
+
+// turn ast into lval
+lval_t* lval_read(const mpc_ast_t* tree) {
+    return lval_read_src(tree, NULL, NULL);
+}
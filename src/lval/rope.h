@@ -0,0 +1,270 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/**********************************************************/
+/*                     rope strings                       */
+/*--------------------------------------------------------*/
+/* NB: strings are immutable, reference counted trees     */
+/*     whose leaves point into shared character buffers.  */
+/*     Concatenation and slicing build new nodes around   */
+/*     the existing ones instead of copying characters,   */
+/*     and index/slice only walk one path of the tree.    */
+/*     Short results are flattened into a single leaf,    */
+/*     and trees are rebalanced when they get too deep.   */
+/*     String literals point straight into the input they */
+/*     were read from (see rope_buf_adopt).               */
+/*     Reference counts are atomic, as ropes are the only */
+/*     values shared between threads (see lval_clone).    */
+/**********************************************************/
+
+// strings up to this length are kept in a single leaf
+#ifndef ROPE_FLAT_MAX
+#define ROPE_FLAT_MAX 64
+#endif
+
+// trees deeper than this are rebalanced
+#ifndef ROPE_MAX_DEPTH
+#define ROPE_MAX_DEPTH 48
+#endif
+
+// shared character buffer
+typedef struct {
+    int refs;
+    char* data;    // owned, either adopted or pointing to inline chars
+    char chars[];
+} rope_buf_t;
+
+// rope node (leaf if left is NULL)
+typedef struct rope_t {
+    int refs;
+    int depth;
+    long len;
+    struct rope_t* left;
+    struct rope_t* right;
+    rope_buf_t* buf;  // leaves: buffer holding the characters
+    const char* data; // leaves: first character inside buf
+} rope_t;
+
+/**********/
+/* buffer */
+/**********/
+
+// take ownership of malloc'd data (e.g. a line read by the repl)
+rope_buf_t* rope_buf_adopt(char* data) {
+    rope_buf_t* b = malloc(sizeof(rope_buf_t));
+    b->refs = 1;
+    b->data = data;
+    return b;
+}
+
+// release reference to buffer
+void rope_buf_release(rope_buf_t* b) {
+    if (b && __atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (b->data != b->chars) free(b->data);
+        free(b);
+    }
+}
+
+/*********/
+/* nodes */
+/*********/
+
+// take new reference to rope
+rope_t* rope_retain(rope_t* r) {
+    __atomic_add_fetch(&r->refs, 1, __ATOMIC_RELAXED);
+    return r;
+}
+
+// release reference to rope
+//  NB: recursion is bounded by ROPE_MAX_DEPTH
+void rope_release(rope_t* r) {
+    if (r && __atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        rope_release(r->left);
+        rope_release(r->right);
+        rope_buf_release(r->buf);
+        free(r);
+    }
+}
+
+// leaf pointing to len characters at data, inside buffer b (borrowed)
+rope_t* rope_leaf(rope_buf_t* b, const char* data, long len) {
+    rope_t* r = malloc(sizeof(rope_t));
+    r->refs = 1;
+    r->depth = 0;
+    r->len = len;
+    r->left = r->right = NULL;
+    r->buf = b;
+    r->data = data;
+    __atomic_add_fetch(&b->refs, 1, __ATOMIC_RELAXED);
+    return r;
+}
+
+// leaf holding a copy of len characters
+rope_t* rope_flat(const char* s, long len) {
+    rope_buf_t* b = malloc(sizeof(rope_buf_t) + len + 1);
+    b->refs = 0;
+    b->data = b->chars;
+    memcpy(b->chars, s, len);
+    b->chars[len] = '\0';
+    return rope_leaf(b, b->chars, len);
+}
+
+// copy characters [start, start + len) of r into out
+void rope_copy_chars(const rope_t* r, long start, long len, char* out) {
+    while (len > 0) {
+        if (!r->left) {
+            memcpy(out, r->data + start, len);
+            return;
+        }
+        // part in left child
+        if (start < r->left->len) {
+            long n = r->left->len - start < len ? r->left->len - start : len;
+            rope_copy_chars(r->left, start, n, out);
+            out += n; len -= n; start = 0;
+        } else {
+            start -= r->left->len;
+        }
+        r = r->right;
+    }
+}
+
+// node joining l and r (both consumed)
+rope_t* rope_node(rope_t* l, rope_t* r) {
+    rope_t* n = malloc(sizeof(rope_t));
+    n->refs = 1;
+    n->depth = 1 + (l->depth > r->depth ? l->depth : r->depth);
+    n->len = l->len + r->len;
+    n->left = l;
+    n->right = r;
+    n->buf = NULL;
+    n->data = NULL;
+    return n;
+}
+
+// collect new references to the leaves of r
+void rope_leaves(rope_t* r, rope_t*** leaves, int* count, int* cap) {
+    for (; r->left; r = r->right)
+        rope_leaves(r->left, leaves, count, cap);
+
+    if (*count == *cap) {
+        *cap = *cap ? *cap * 2 : 16;
+        *leaves = realloc(*leaves, sizeof(rope_t*) * *cap);
+    }
+    (*leaves)[(*count)++] = rope_retain(r);
+}
+
+// balanced tree over leaves [from, to) (references are consumed)
+rope_t* rope_build(rope_t** leaves, int from, int to) {
+    if (to - from == 1) return leaves[from];
+    int mid = from + (to - from) / 2;
+    return rope_node(rope_build(leaves, from, mid),
+                     rope_build(leaves, mid, to));
+}
+
+// rebalance r (consumed)
+rope_t* rope_balance(rope_t* r) {
+    rope_t** leaves = NULL;
+    int count = 0, cap = 0;
+    rope_leaves(r, &leaves, &count, &cap);
+    rope_release(r);
+
+    rope_t* ret = rope_build(leaves, 0, count);
+    free(leaves);
+    return ret;
+}
+
+/**************/
+/* operations */
+/**************/
+
+// concatenation of l and r (both consumed)
+rope_t* rope_concat(rope_t* l, rope_t* r) {
+    if (l->len == 0) { rope_release(l); return r; }
+    if (r->len == 0) { rope_release(r); return l; }
+
+    // short result: flatten
+    if (l->len + r->len <= ROPE_FLAT_MAX) {
+        char buf[ROPE_FLAT_MAX];
+        rope_copy_chars(l, 0, l->len, buf);
+        rope_copy_chars(r, 0, r->len, buf + l->len);
+        rope_t* ret = rope_flat(buf, l->len + r->len);
+        rope_release(l); rope_release(r);
+        return ret;
+    }
+
+    // appending short string to short right end: merge them
+    //  NB: keeps repeated appends from creating a leaf per append
+    if (l->left && !l->right->left &&
+        l->right->len + r->len <= ROPE_FLAT_MAX) {
+        rope_t* ll = rope_retain(l->left);
+        rope_t* lr = rope_retain(l->right);
+        rope_release(l);
+        return rope_concat(ll, rope_concat(lr, r));
+    }
+
+    rope_t* ret = rope_node(l, r);
+    return ret->depth > ROPE_MAX_DEPTH ? rope_balance(ret) : ret;
+}
+
+// characters [start, end) of r (borrowed)
+rope_t* rope_slice(rope_t* r, long start, long end) {
+    assert(0 <= start && start <= end && end <= r->len &&
+           "slicing rope out of bounds");
+
+    if (start == 0 && end == r->len) return rope_retain(r);
+
+    // leaf: share buffer (or copy if short enough to not keep a
+    // large buffer alive)
+    if (!r->left) {
+        return end - start <= ROPE_FLAT_MAX ?
+            rope_flat(r->data + start, end - start) :
+            rope_leaf(r->buf, r->data + start, end - start);
+    }
+
+    long mid = r->left->len;
+    if (end <= mid)   return rope_slice(r->left, start, end);
+    if (start >= mid) return rope_slice(r->right, start - mid, end - mid);
+    return rope_concat(rope_slice(r->left, start, mid),
+                       rope_slice(r->right, 0, end - mid));
+}
+
+// character at position j of r
+char rope_at(const rope_t* r, long j) {
+    assert(0 <= j && j < r->len && "indexing rope out of bounds");
+
+    while (r->left) {
+        if (j < r->left->len) {
+            r = r->left;
+        } else {
+            j -= r->left->len;
+            r = r->right;
+        }
+    }
+    return r->data[j];
+}
+
+// true if a and b hold the same characters
+int rope_eq(const rope_t* a, const rope_t* b) {
+    if (a == b) return 1;
+    if (a->len != b->len) return 0;
+
+    char bufa[256], bufb[256];
+    for (long j = 0; j < a->len; j += sizeof(bufa)) {
+        long n = a->len - j < (long) sizeof(bufa) ? a->len - j : sizeof(bufa);
+        rope_copy_chars(a, j, n, bufa);
+        rope_copy_chars(b, j, n, bufb);
+        if (memcmp(bufa, bufb, n) != 0) return 0;
+    }
+    return 1;
+}
+
+// call fn on every leaf of r, in order
+void rope_each(const rope_t* r, void (*fn)(const char*, long, void*),
+               void* ctx) {
+    for (; r->left; r = r->right)
+        rope_each(r->left, fn, ctx);
+    fn(r->data, r->len, ctx);
+}
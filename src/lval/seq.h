@@ -0,0 +1,509 @@
+#pragma once
+
+#include <stdio.h>
+#include <ctype.h>
+#include <limits.h>
+
+#include "mpc.h"
+
+#include "../parsing.h"
+#include "core.h"
+#include "expr.h"
+#include "read.h"
+#include "eval.h"
+#include "rope.h"
+#include "lassert.h"
+
+/**********************************************************/
+/*                    lazy sequences                      */
+/*--------------------------------------------------------*/
+/* NB: a sequence value is an immutable recipe: a source  */
+/*     (range, list, vector or file) followed by any      */
+/*     number of stages (map, filter, take). Consuming it */
+/*     instantiates an iterator per stage and pulls one   */
+/*     element at a time through the whole chain, so      */
+/*     stages are fused and no intermediate list is ever  */
+/*     built. Sequences can be consumed any number of     */
+/*     times, every consumer starting over.               */
+/**********************************************************/
+
+// size of chunks read from files
+#ifndef SEQ_FILE_CHUNK
+#define SEQ_FILE_CHUNK 65536
+#endif
+
+// most elements collect preallocates from a known length
+#ifndef SEQ_COLLECT_PREALLOC
+#define SEQ_COLLECT_PREALLOC (1 << 20)
+#endif
+
+// kinds of sequences
+typedef enum {
+    SEQ_RANGE,  // numbers from start to end (excluded) by step
+    SEQ_LIST,   // elements of q-expression or vector
+    SEQ_FILE,   // top-level forms read from file
+    SEQ_MAP,    // fn applied to elements of src
+    SEQ_FILTER, // elements of src for which fn is true
+    SEQ_TAKE    // first n elements of src
+} seq_kind_t;
+
+// sequence recipe
+typedef struct seq_t {
+    int refs;
+    seq_kind_t kind;
+    struct seq_t* src; // stages: upstream sequence
+    lval_t* val;       // map/filter: function, list: elements
+    char* path;        // file: path
+    long start;        // range: first number
+    long end;          // range: end (unless infinite), take: n
+    long step;         // range: step
+    int infinite;      // range: no end
+} seq_t;
+
+// sequence being consumed
+typedef struct seq_iter_t {
+    const seq_t* seq;
+    struct seq_iter_t* src;
+    long pos;       // range: next number, list: next index, take: taken
+    int done;
+    // file
+    FILE* file;
+    alba_parser_t* parser;
+    char* buf;
+    long len;
+    long cap;
+    int eof;
+} seq_iter_t;
+
+/***********/
+/* recipes */
+/***********/
+
+// new recipe of given kind
+seq_t* seq_new(seq_kind_t kind) {
+    seq_t* s = calloc(1, sizeof(seq_t));
+    s->refs = 1;
+    s->kind = kind;
+    return s;
+}
+
+// take new reference to recipe
+seq_t* seq_retain(seq_t* s) {
+    ++(s->refs);
+    return s;
+}
+
+// release reference to recipe
+void seq_release(seq_t* s) {
+    if (--(s->refs) > 0) return;
+
+    if (s->src) seq_release(s->src);
+    if (s->val) lval_del(s->val);
+    free(s->path);
+    free(s);
+}
+
+// deep copy of recipe (see lval_clone)
+seq_t* seq_clone(const seq_t* s) {
+    seq_t* ret = seq_new(s->kind);
+    *ret = *s;
+    ret->refs = 1;
+    if (s->src) ret->src = seq_clone(s->src);
+    if (s->val) ret->val = lval_clone(s->val);
+    if (s->path) ret->path = strdup(s->path);
+    return ret;
+}
+
+// stage of kind over src (consumed)
+seq_t* seq_stage(seq_kind_t kind, seq_t* src, lval_t* fn, long n) {
+    seq_t* s = seq_new(kind);
+    s->src = src;
+    s->val = fn;
+    s->end = n;
+    return s;
+}
+
+// number of elements of recipe (-1 if not known without consuming it)
+long seq_length(const seq_t* s) {
+    long n;
+    switch (s->kind) {
+        case SEQ_RANGE:
+            if (s->infinite) return LONG_MAX;
+            if (s->step > 0 ? s->start >= s->end : s->start <= s->end)
+                return 0;
+            if (__builtin_sub_overflow(s->end, s->start, &n)) return -1;
+            // NB: n and step have the same sign
+            return n / s->step + (n % s->step != 0);
+        case SEQ_LIST:
+            return s->val->type == LVAL_VEC ? s->val->len : s->val->count;
+        case SEQ_MAP:
+            return seq_length(s->src);
+        case SEQ_TAKE:
+            n = seq_length(s->src);
+            return n < 0 ? -1 : (n < s->end ? n : s->end);
+        default:
+            return -1;
+    }
+}
+
+/*************/
+/* iterators */
+/*************/
+
+// start consuming recipe
+seq_iter_t* seq_iter_new(const seq_t* s) {
+    seq_iter_t* it = calloc(1, sizeof(seq_iter_t));
+    it->seq = s;
+    if (s->src) it->src = seq_iter_new(s->src);
+
+    switch (s->kind) {
+        case SEQ_RANGE:
+            it->pos = s->start;
+            break;
+        case SEQ_FILE:
+            it->file = fopen(s->path, "r");
+            break;
+        default:
+            break;
+    }
+    return it;
+}
+
+// stop consuming sequence
+void seq_iter_del(seq_iter_t* it) {
+    if (it->src) seq_iter_del(it->src);
+    if (it->file) fclose(it->file);
+    if (it->parser) alba_free_parser(it->parser);
+    free(it->buf);
+    free(it);
+}
+
+// find first top-level form in s[0..len) (at [*start, *end))
+//  NB: returns 1 if found, 0 if more input is needed to tell
+//      and -1 if there is nothing but whitespace
+int seq_scan_form(const char* s, long len, int eof, long* start, long* end) {
+    long j = 0;
+    while (j < len && isspace((unsigned char) s[j])) ++j;
+    if (j == len) return eof ? -1 : 0;
+    *start = j;
+
+    // atom: up to whitespace or delimiter
+    if (!strchr("({[\"", s[j])) {
+        while (j < len && !isspace((unsigned char) s[j]) &&
+               !strchr("(){}[]\"", s[j]))
+            ++j;
+        if (j == len && !eof) return 0;
+        *end = j == *start ? j + 1 : j;
+        return 1;
+    }
+
+    // string or expression: up to matching delimiter
+    int depth = 0, str = 0;
+    for (; j < len; ++j) {
+        char c = s[j];
+        if (str) {
+            if (c == '\\') ++j;
+            else if (c == '"') str = 0;
+        } else if (c == '"') {
+            str = 1;
+        } else if (strchr("({[", c)) {
+            ++depth;
+        } else if (strchr(")}]", c)) {
+            --depth;
+        }
+        if (!str && depth <= 0) {
+            *end = j + 1;
+            return 1;
+        }
+    }
+
+    // unterminated: let the parser report it
+    if (!eof) return 0;
+    *end = len;
+    return 1;
+}
+
+// next form of file (NULL at end)
+//  NB: s-expressions are returned as q-expressions, so that forms
+//      can be passed around as data and evaluated with eval
+lval_t* seq_file_next(seq_iter_t* it) {
+    if (!it->file)
+        return lval_err("cannot open file!");
+
+    long start, end;
+    int found;
+    while ((found = seq_scan_form(it->buf, it->len, it->eof,
+                                  &start, &end)) == 0) {
+        if (it->len + SEQ_FILE_CHUNK > it->cap) {
+            it->cap = it->len + SEQ_FILE_CHUNK;
+            it->buf = realloc(it->buf, it->cap);
+        }
+        size_t n = fread(it->buf + it->len, 1, SEQ_FILE_CHUNK, it->file);
+        it->len += n;
+        if (n < SEQ_FILE_CHUNK) it->eof = 1;
+    }
+    if (found < 0) return NULL;
+
+    // parse form on its own
+    //  NB: the form's text is kept alive by the strings read from it
+    char* text = malloc(end - start + 1);
+    memcpy(text, it->buf + start, end - start);
+    text[end - start] = '\0';
+    memmove(it->buf, it->buf + end, it->len - end);
+    it->len -= end;
+
+    if (!it->parser) it->parser = alba_new_parser();
+    rope_buf_t* src = rope_buf_adopt(text);
+    lval_t* ret;
+    mpc_result_t r;
+    if (mpc_parse(it->seq->path, text, it->parser->program, &r)) {
+        lval_t* prog = lval_read_src(r.output, src, text);
+        ret = lval_take(prog, 0);
+        if (ret->type == LVAL_SEXPR) ret->type = LVAL_QEXPR;
+        mpc_ast_delete(r.output);
+    } else {
+        char* msg = mpc_err_string(r.error);
+        ret = lval_err(msg);
+        free(msg);
+        mpc_err_delete(r.error);
+    }
+    rope_buf_release(src);
+
+    return ret;
+}
+
+// next element of sequence (NULL at end)
+//  NB: errors are returned as elements and end the sequence
+lval_t* seq_iter_next(env_t* e, seq_iter_t* it) {
+    const seq_t* s = it->seq;
+    lval_t* ret = NULL;
+    if (it->done) return NULL;
+
+    // elements are charged to the budget of the evaluation, if any
+    //  NB: so that budgets stop builtins going through infinite ones
+    if (!machine_charge()) {
+        it->done = 1;
+        return machine_starved();
+    }
+
+    switch (s->kind) {
+        case SEQ_RANGE:
+            if (!s->infinite && (s->step > 0 ? it->pos >= s->end :
+                                               it->pos <= s->end))
+                break;
+            ret = lval_num(it->pos);
+            // stop instead of wrapping around
+            if (__builtin_add_overflow(it->pos, s->step, &it->pos))
+                it->done = 1;
+            break;
+        case SEQ_LIST:
+            if (s->val->type == LVAL_VEC) {
+                if (it->pos < s->val->len)
+                    ret = lval_num(s->val->vec[it->pos++]);
+            } else {
+                if (it->pos < s->val->count)
+                    ret = lval_copy(s->val->cell[it->pos++]);
+            }
+            break;
+        case SEQ_FILE:
+            ret = seq_file_next(it);
+            break;
+        case SEQ_MAP:
+            ret = seq_iter_next(e, it->src);
+            if (ret && ret->type != LVAL_ERR)
+                ret = lval_apply(e, s->val, 1, &ret);
+            break;
+        case SEQ_FILTER:
+            while ((ret = seq_iter_next(e, it->src)) &&
+                   ret->type != LVAL_ERR) {
+                lval_t* arg = lval_copy(ret);
+                lval_t* keep = lval_apply(e, s->val, 1, &arg);
+                if (keep->type == LVAL_ERR) {
+                    lval_del(ret);
+                    ret = keep;
+                    break;
+                }
+                int t = lval_is_true(keep);
+                lval_del(keep);
+                if (t) break;
+                lval_del(ret);
+            }
+            break;
+        case SEQ_TAKE:
+            // NB: never pulls more than n elements from upstream
+            if (it->pos < s->end) {
+                ++(it->pos);
+                ret = seq_iter_next(e, it->src);
+            }
+            break;
+        default:
+            assert(0 && "trying to iterate sequence of unknown kind");
+    }
+
+    if (!ret || ret->type == LVAL_ERR) it->done = 1;
+    return ret;
+}
+
+/************/
+/* builtins */
+/************/
+
+// new reference to sequence of lval (NULL if it is not a sequence)
+//  NB: q-expressions and vectors are sequences of their elements
+seq_t* seq_of(const lval_t* v) {
+    if (v->type == LVAL_SEQ) return seq_retain(v->seq);
+    if (v->type != LVAL_QEXPR && v->type != LVAL_VEC) return NULL;
+
+    seq_t* s = seq_new(SEQ_LIST);
+    s->val = lval_copy(v);
+    return s;
+}
+
+// true if lval can be applied by lval_apply
+int seq_is_fn(const lval_t* v) {
+    return v->type == LVAL_BUILTIN || (v->type == LVAL_QEXPR && v->count > 0);
+}
+
+// range ([start] end [step])
+lval_t* builtin_range(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 3, "range");
+    for (int j = 0; j < argc; ++j)
+        LASSERTV(argv[j]->type == LVAL_NUM,
+                 "'range' needs to be passed numbers");
+
+    seq_t* s = seq_new(SEQ_RANGE);
+    s->start = argc == 1 ? 0 : argv[0]->num;
+    s->end = argc == 1 ? argv[0]->num : argv[1]->num;
+    s->step = argc == 3 ? argv[2]->num : 1;
+
+    if (s->step == 0) {
+        seq_release(s);
+        return lval_err("'range' cannot have a step of 0!");
+    }
+    return lval_seq(s);
+}
+
+// range-from (all numbers from start by step, without end)
+lval_t* builtin_range_from(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 2, "range-from");
+    for (int j = 0; j < argc; ++j)
+        LASSERTV(argv[j]->type == LVAL_NUM,
+                 "'range-from' needs to be passed numbers");
+
+    seq_t* s = seq_new(SEQ_RANGE);
+    s->start = argv[0]->num;
+    s->step = argc == 2 ? argv[1]->num : 1;
+    s->infinite = 1;
+    return lval_seq(s);
+}
+
+// map and filter (stage applying function to elements)
+lval_t* builtin_seq_fn(seq_kind_t kind, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 2, 2, "map/filter");
+    LASSERTV(seq_is_fn(argv[0]),
+             "'map' and 'filter' need to be passed a function first");
+
+    seq_t* src = seq_of(argv[1]);
+    LASSERTV(src, "'map' and 'filter' need to be passed a sequence");
+    return lval_seq(seq_stage(kind, src, lval_copy(argv[0]), 0));
+}
+lval_t* builtin_map(env_t* env, int argc, lval_t* const* argv) {
+    return builtin_seq_fn(SEQ_MAP, argc, argv);
+}
+lval_t* builtin_filter(env_t* env, int argc, lval_t* const* argv) {
+    return builtin_seq_fn(SEQ_FILTER, argc, argv);
+}
+
+// take (first n elements)
+lval_t* builtin_take(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 2, 2, "take");
+    LASSERTV(argv[0]->type == LVAL_NUM && argv[0]->num >= 0,
+             "'take' needs to be passed a count first");
+
+    seq_t* src = seq_of(argv[1]);
+    LASSERTV(src, "'take' needs to be passed a sequence");
+    return lval_seq(seq_stage(SEQ_TAKE, src, NULL, argv[0]->num));
+}
+
+// reduce (fold elements into accumulator, from the left)
+lval_t* builtin_reduce(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 3, 3, "reduce");
+    LASSERTV(seq_is_fn(argv[0]),
+             "'reduce' needs to be passed a function first");
+
+    seq_t* s = seq_of(argv[2]);
+    LASSERTV(s, "'reduce' needs to be passed a sequence");
+
+    seq_iter_t* it = seq_iter_new(s);
+    lval_t* acc = lval_copy(argv[1]);
+    lval_t* x;
+    while (acc->type != LVAL_ERR && (x = seq_iter_next(env, it))) {
+        if (x->type == LVAL_ERR) {
+            lval_del(acc);
+            acc = x;
+            break;
+        }
+        lval_t* args[2] = { acc, x };
+        acc = lval_apply(env, argv[0], 2, args);
+    }
+
+    seq_iter_del(it);
+    seq_release(s);
+    return acc;
+}
+
+// collect (q-expression of all elements)
+lval_t* builtin_collect(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "collect");
+
+    seq_t* s = seq_of(argv[0]);
+    LASSERTV(s, "'collect' needs to be passed a sequence");
+
+    // preallocate from the length when known, grow geometrically otherwise
+    //  NB: ret is new, so elements are stored without lval_add
+    long cap = seq_length(s);
+    if (cap < 0) cap = 16;
+    if (cap > SEQ_COLLECT_PREALLOC) cap = SEQ_COLLECT_PREALLOC;
+    lval_t* ret = lval_qexpr();
+    ret->cell = cap ? malloc(sizeof(lval_t*) * cap) : NULL;
+
+    seq_iter_t* it = seq_iter_new(s);
+    lval_t* x;
+    while ((x = seq_iter_next(env, it))) {
+        if (x->type == LVAL_ERR) {
+            lval_del(ret);
+            ret = x;
+            break;
+        }
+        if (ret->count == cap) {
+            cap = cap ? cap * 2 : 16;
+            ret->cell = realloc(ret->cell, sizeof(lval_t*) * cap);
+        }
+        ret->cell[ret->count++] = x;
+    }
+    if (ret->type == LVAL_QEXPR && ret->count < cap) {
+        if (ret->count == 0) {
+            free(ret->cell);
+            ret->cell = NULL;
+        } else {
+            ret->cell = realloc(ret->cell, sizeof(lval_t*) * ret->count);
+        }
+    }
+
+    seq_iter_del(it);
+    seq_release(s);
+    return ret;
+}
+
+// read-file (sequence of the top-level forms of a file)
+lval_t* builtin_read_file(env_t* env, int argc, lval_t* const* argv) {
+    LASSERTV_BOUNDS(argc, 1, 1, "read-file");
+    LASSERTV_TYPES(argv, LVAL_STR, "read-file");
+
+    const rope_t* path = argv[0]->str;
+    seq_t* s = seq_new(SEQ_FILE);
+    s->path = malloc(path->len + 1);
+    rope_copy_chars(path, 0, path->len, s->path);
+    s->path[path->len] = '\0';
+    return lval_seq(s);
+}
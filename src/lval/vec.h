@@ -0,0 +1,194 @@
+#pragma once
+
+#include <limits.h>
+
+#include "core.h"
+#include "arith.h"
+
+/**********************************************************/
+/*                 numeric vector kernels                 */
+/*--------------------------------------------------------*/
+/* NB: vectors are packed arrays of longs (the only       */
+/*     numeric type of the language). Their kernels are   */
+/*     written once in vec_kernels.h with GCC vector      */
+/*     extensions and instantiated for several widths:    */
+/*     the widest one supported by the running CPU is     */
+/*     picked the first time a kernel is needed. Results  */
+/*     follow the exact semantics of arith.h: kernels     */
+/*     only report that a lane might have overflowed, and */
+/*     the caller then redoes the work exactly.           */
+/*     Define ALBA_VEC_SCALAR to always use 1 lane.       */
+/**********************************************************/
+
+// scalar kernels (1 lane)
+#define VK_NAME(name) vk_scalar_##name
+#define VK_TARGET
+#define VK_BYTES 8
+#include "vec_kernels.h"
+#undef VK_NAME
+#undef VK_TARGET
+#undef VK_BYTES
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(ALBA_VEC_SCALAR)
+#define VEC_X86
+
+// SSE2 kernels (2 lanes, always available on x86-64)
+#define VK_NAME(name) vk_sse2_##name
+#define VK_TARGET
+#define VK_BYTES 16
+#include "vec_kernels.h"
+#undef VK_NAME
+#undef VK_TARGET
+#undef VK_BYTES
+
+// AVX2 kernels (4 lanes)
+#define VK_NAME(name) vk_avx2_##name
+#define VK_TARGET __attribute__((target("avx2")))
+#define VK_BYTES 32
+#include "vec_kernels.h"
+#undef VK_NAME
+#undef VK_TARGET
+#undef VK_BYTES
+#endif
+
+// kernel table for an instruction set
+typedef struct {
+    const char* isa;
+    int  (*addsub)(const long*, const long*, long*, int, int);
+    int  (*fits32)(const long*, int);
+    void (*mul32)(const long*, const long*, long*, int);
+    int  (*sum)(const long*, const long*, int, arith_wide_t*);
+    long (*minmax)(const long*, int, int);
+    int  (*scan)(const long*, long*, int);
+} vec_kernels_t;
+
+#define VEC_KERNELS(ISA, PREFIX) {                                  \
+        ISA, &PREFIX##vk_addsub, &PREFIX##vk_fits32,                \
+        &PREFIX##vk_mul32, &PREFIX##vk_sum,                         \
+        &PREFIX##vk_minmax, &PREFIX##vk_scan                        \
+    }
+
+// kernels selected for the running CPU
+const vec_kernels_t* vec_kernels(void) {
+    static const vec_kernels_t scalar = VEC_KERNELS("scalar", vk_scalar_);
+#ifdef VEC_X86
+    static const vec_kernels_t sse2 = VEC_KERNELS("sse2", vk_sse2_);
+    static const vec_kernels_t avx2 = VEC_KERNELS("avx2", vk_avx2_);
+#endif
+    static const vec_kernels_t* selected = NULL;
+
+    if (!selected) {
+        selected = &scalar;
+#ifdef VEC_X86
+        __builtin_cpu_init();
+        selected = __builtin_cpu_supports("avx2") ? &avx2 : &sse2;
+#endif
+    }
+    return selected;
+}
+
+/*************/
+/* operators */
+/*************/
+
+// element j of operand (vectors are indexed, numbers broadcast)
+long vec_elem(const lval_t* v, int j) {
+    return v->type == LVAL_VEC ? v->vec[j] : v->num;
+}
+
+// operand as an array of n elements, broadcasting numbers into buf
+const long* vec_operand(const lval_t* v, long* buf, int n) {
+    if (v->type == LVAL_VEC) return v->vec;
+    for (int j = 0; j < n; ++j) buf[j] = v->num;
+    return buf;
+}
+
+// exact element-wise application of op, one column at a time
+arith_status_t vec_apply_exact(arith_op_t op, int argc,
+                               lval_t* const* argv, int n, long* out) {
+    long buf[64];
+    long* col = argc <= 64 ? buf : malloc(sizeof(long) * argc);
+    arith_status_t status = ARITH_OK;
+
+    for (int j = 0; j < n && status == ARITH_OK; ++j) {
+        for (int a = 0; a < argc; ++a)
+            col[a] = vec_elem(argv[a], j);
+        status = arith_apply(op, col, argc, &out[j]);
+    }
+
+    if (col != buf) free(col);
+    return status;
+}
+
+// element-wise application of op to numbers and vectors of length n
+//  NB: folds left to right with the SIMD kernels, and falls back to
+//      the exact path as soon as a step might have overflowed (or
+//      for division, which has no SIMD instruction)
+arith_status_t vec_apply(arith_op_t op, int argc,
+                         lval_t* const* argv, int n, long* out) {
+    const vec_kernels_t* k = vec_kernels();
+
+    if (op == ARITH_DIV || argc == 1)
+        return vec_apply_exact(op, argc, argv, n, out);
+
+    long* tmp = malloc(sizeof(long) * (n ? n : 1));
+    memcpy(out, vec_operand(argv[0], tmp, n), sizeof(long) * n);
+
+    int exact = 0;
+    for (int a = 1; a < argc && !exact; ++a) {
+        const long* x = vec_operand(argv[a], tmp, n);
+        if (op == ARITH_MUL) {
+            exact = !k->fits32(out, n) || !k->fits32(x, n);
+            if (!exact) k->mul32(out, x, out, n);
+        } else {
+            exact = k->addsub(out, x, out, n, op == ARITH_SUB);
+        }
+    }
+
+    free(tmp);
+    return exact ? vec_apply_exact(op, argc, argv, n, out) : ARITH_OK;
+}
+
+// exact sum of n elements
+arith_status_t vec_sum(const long* xs, int n, long* out) {
+    arith_wide_t w;
+    if (vec_kernels()->sum(xs, NULL, n, &w))
+        w = arith_sum(xs, n);
+
+    if (w.wraps != 0) return ARITH_OVERFLOW;
+    *out = w.lo;
+    return ARITH_OK;
+}
+
+// exact dot product of n elements
+arith_status_t vec_dot(const long* xs, const long* ys, int n, long* out) {
+    const vec_kernels_t* k = vec_kernels();
+    arith_wide_t w;
+
+    // products of 32 bit numbers always fit
+    if (k->fits32(xs, n) && k->fits32(ys, n) && !k->sum(xs, ys, n, &w)) {
+        if (w.wraps != 0) return ARITH_OVERFLOW;
+        *out = w.lo;
+        return ARITH_OK;
+    }
+
+    __int128 acc = 0;
+    for (int j = 0; j < n; ++j)
+        if (__builtin_add_overflow(acc, (__int128) xs[j] * ys[j], &acc))
+            return ARITH_OVERFLOW;
+
+    if (acc < LONG_MIN || acc > LONG_MAX) return ARITH_OVERFLOW;
+    *out = (long) acc;
+    return ARITH_OK;
+}
+
+// copy of elements of xs whose mask is non-zero into out
+//  NB: branchless scalar compaction, returns number of elements kept
+int vec_filter(const long* xs, const long* mask, int n, long* out) {
+    int m = 0;
+    for (int j = 0; j < n; ++j) {
+        out[m] = xs[j];
+        m += mask[j] != 0;
+    }
+    return m;
+}
@@ -0,0 +1,196 @@
+// NB: no include guard, this file is a template instantiated by vec.h
+//     once per instruction set. Before including it, define:
+//      VK_NAME(name)  name of instantiated kernel
+//      VK_TARGET      function attributes selecting the instruction set
+//      VK_BYTES       vector width in bytes (multiple of sizeof(long))
+
+#define VK_LANES ((int) (VK_BYTES / sizeof(long)))
+
+typedef long          VK_NAME(vec_t)  __attribute__((vector_size(VK_BYTES)));
+typedef unsigned long VK_NAME(uvec_t) __attribute__((vector_size(VK_BYTES)));
+
+// true if any lane has its sign bit set
+VK_TARGET
+int VK_NAME(vk_any_sign)(VK_NAME(uvec_t) m) {
+    unsigned long acc = 0;
+    for (int l = 0; l < VK_LANES; ++l) acc |= m[l];
+    return (long) acc < 0;
+}
+
+// element-wise a + b (or a - b if sub) into out
+//  NB: returns 1 if any element overflowed
+VK_TARGET
+int VK_NAME(vk_addsub)(const long* a, const long* b, long* out, int n, int sub) {
+    VK_NAME(uvec_t) ovf = { 0 };
+    int j = 0;
+
+    for (; j + VK_LANES <= n; j += VK_LANES) {
+        VK_NAME(uvec_t) x, y, r;
+        memcpy(&x, a + j, sizeof(x));
+        memcpy(&y, b + j, sizeof(y));
+        if (sub) {
+            r = x - y;
+            // signed overflow: operands of different sign, result
+            // of different sign than the first one
+            ovf |= (x ^ y) & (x ^ r);
+        } else {
+            r = x + y;
+            ovf |= (x ^ r) & (y ^ r);
+        }
+        memcpy(out + j, &r, sizeof(r));
+    }
+
+    int err = VK_NAME(vk_any_sign)(ovf);
+    for (; j < n; ++j) {
+        // NB: operands are loaded first, as out may alias a (GCC can
+        //     miss the overflow when the result overwrites an operand)
+        long x = a[j], y = b[j], r;
+        err |= sub ? __builtin_sub_overflow(x, y, &r) :
+                     __builtin_add_overflow(x, y, &r);
+        out[j] = r;
+    }
+    return err;
+}
+
+// true if all elements fit in 32 bits (products cannot overflow)
+VK_TARGET
+int VK_NAME(vk_fits32)(const long* a, int n) {
+    VK_NAME(vec_t) lo, hi;
+    for (int l = 0; l < VK_LANES; ++l) { lo[l] = INT_MIN; hi[l] = INT_MAX; }
+    VK_NAME(vec_t) bad = { 0 };
+    int j = 0;
+
+    for (; j + VK_LANES <= n; j += VK_LANES) {
+        VK_NAME(vec_t) x;
+        memcpy(&x, a + j, sizeof(x));
+        bad |= (x < lo) | (x > hi);
+    }
+
+    for (int l = 0; l < VK_LANES; ++l)
+        if (bad[l]) return 0;
+    for (; j < n; ++j)
+        if (a[j] < INT_MIN || a[j] > INT_MAX) return 0;
+    return 1;
+}
+
+// element-wise a * b into out, for operands that fit in 32 bits
+VK_TARGET
+void VK_NAME(vk_mul32)(const long* a, const long* b, long* out, int n) {
+    int j = 0;
+    for (; j + VK_LANES <= n; j += VK_LANES) {
+        VK_NAME(vec_t) x, y;
+        memcpy(&x, a + j, sizeof(x));
+        memcpy(&y, b + j, sizeof(y));
+        x *= y;
+        memcpy(out + j, &x, sizeof(x));
+    }
+    for (; j < n; ++j)
+        out[j] = a[j] * b[j];
+}
+
+// sum of elements (or of products a * b if b is not NULL, in which
+// case elements need to fit in 32 bits)
+//  NB: returns 1 if any lane overflowed, the caller then needs to
+//      redo the sum exactly
+VK_TARGET
+int VK_NAME(vk_sum)(const long* a, const long* b, int n, arith_wide_t* w) {
+    VK_NAME(uvec_t) acc = { 0 }, ovf = { 0 };
+    int j = 0;
+
+    for (; j + VK_LANES <= n; j += VK_LANES) {
+        VK_NAME(vec_t) x;
+        memcpy(&x, a + j, sizeof(x));
+        if (b) {
+            VK_NAME(vec_t) y;
+            memcpy(&y, b + j, sizeof(y));
+            x *= y;
+        }
+        VK_NAME(uvec_t) ux = (VK_NAME(uvec_t)) x;
+        VK_NAME(uvec_t) r = acc + ux;
+        ovf |= (acc ^ r) & (ux ^ r);
+        acc = r;
+    }
+
+    if (VK_NAME(vk_any_sign)(ovf)) return 1;
+
+    w->lo = 0; w->wraps = 0;
+    for (int l = 0; l < VK_LANES; ++l)
+        arith_wide_add(w, (long) acc[l]);
+    for (; j < n; ++j)
+        arith_wide_add(w, b ? a[j] * b[j] : a[j]);
+    return 0;
+}
+
+// minimum (or maximum if max) of n > 0 elements
+VK_TARGET
+long VK_NAME(vk_minmax)(const long* a, int n, int max) {
+    long ret = a[0];
+    int j = 0;
+
+    if (n >= VK_LANES) {
+        VK_NAME(vec_t) best;
+        memcpy(&best, a, sizeof(best));
+        for (j = VK_LANES; j + VK_LANES <= n; j += VK_LANES) {
+            VK_NAME(vec_t) x;
+            memcpy(&x, a + j, sizeof(x));
+            VK_NAME(vec_t) m = max ? x > best : x < best;
+            best = (x & m) | (best & ~m);
+        }
+        ret = best[0];
+        for (int l = 1; l < VK_LANES; ++l)
+            if (max ? best[l] > ret : best[l] < ret) ret = best[l];
+    }
+
+    for (; j < n; ++j)
+        if (max ? a[j] > ret : a[j] < ret) ret = a[j];
+    return ret;
+}
+
+// inclusive prefix sum of a into out
+//  NB: returns 1 if any prefix sum overflowed
+VK_TARGET
+int VK_NAME(vk_scan)(const long* a, long* out, int n) {
+    long carry = 0;
+    int j = 0;
+
+    for (; j + VK_LANES <= n; j += VK_LANES) {
+        VK_NAME(uvec_t) x, ovf = { 0 };
+        memcpy(&x, a + j, sizeof(x));
+
+        // in-register scan: add copies of x shifted by 1, 2, 4... lanes
+        for (int s = 1; s < VK_LANES; s *= 2) {
+            VK_NAME(uvec_t) y = { 0 };
+            for (int l = s; l < VK_LANES; ++l) y[l] = x[l - s];
+            VK_NAME(uvec_t) r = x + y;
+            ovf |= (x ^ r) & (y ^ r);
+            x = r;
+        }
+        VK_NAME(uvec_t) c, r;
+        for (int l = 0; l < VK_LANES; ++l) c[l] = carry;
+        r = x + c;
+        ovf |= (x ^ r) & (c ^ r);
+
+        // partial sums of lanes may overflow where prefix sums do
+        // not: redo the block one element at a time to be exact
+        if (VK_NAME(vk_any_sign)(ovf)) {
+            for (int l = 0; l < VK_LANES; ++l) {
+                if (__builtin_add_overflow(carry, a[j + l], &carry))
+                    return 1;
+                out[j + l] = carry;
+            }
+            continue;
+        }
+
+        memcpy(out + j, &r, sizeof(r));
+        carry = (long) r[VK_LANES - 1];
+    }
+
+    for (; j < n; ++j) {
+        if (__builtin_add_overflow(carry, a[j], &carry))
+            return 1;
+        out[j] = carry;
+    }
+    return 0;
+}
+
+#undef VK_LANES
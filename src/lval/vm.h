@@ -0,0 +1,324 @@
+#pragma once
+
+#include "core.h"
+#include "expr.h"
+#include "env.h"
+#include "eval.h"
+#include "builtin.h"
+
+/**********************************************************/
+/*                  bytecode virtual machine              */
+/*--------------------------------------------------------*/
+/* NB: forms are compiled into a flat array of            */
+/*     instructions run on an explicit value stack.       */
+/*     When GCC/Clang labels-as-values are available each */
+/*     instruction stores the address of its handler      */
+/*     (direct threading), otherwise a portable switch is */
+/*     used. Define ALBA_VM_SWITCH to force the latter.   */
+/**********************************************************/
+
+#if defined(__GNUC__) && !defined(ALBA_VM_SWITCH)
+#define VM_THREADED
+#endif
+
+// opcodes
+typedef enum {
+    OP_CONST,       // push copy of constant
+    OP_LOAD,        // push copy of value bound to symbol
+    OP_CALL,        // call callee with ARG arguments (all on the stack)
+    OP_RET,         // return top of the stack
+    // superinstructions
+    //  NB: they are always followed by their generic sequence, which
+    //      is skipped (ARG instructions) when the fast path applies
+    OP_ADD_SYM_NUM, // (+ sym num)
+    OP_HEAD_SYM,    // (head sym)
+    OP_COUNT
+} vm_op_t;
+
+// single instruction
+typedef struct {
+    const void* handler; // threaded code: address of handler
+    vm_op_t op;
+    int arg;
+    lval_t* k;           // constant or symbol operand
+    lval_t* k2;          // second operand for superinstructions
+    int slot;            // superinstructions: slot of callee when compiled
+} vm_insn_t;
+
+// compiled form
+typedef struct vm_chunk_t {
+    vm_insn_t* code;
+    int count;
+    int depth;    // maximum stack depth reached while running
+    int threaded; // handlers already resolved
+} vm_chunk_t;
+
+/************/
+/* compiler */
+/************/
+
+// append instruction to chunk
+void vm_emit(vm_chunk_t* c, vm_op_t op, int arg, lval_t* k, lval_t* k2) {
+    ++(c->count);
+    c->code = realloc(c->code, sizeof(vm_insn_t) * c->count);
+    c->code[c->count - 1] = (vm_insn_t){ NULL, op, arg, k, k2, -1 };
+}
+
+// true if v is the symbol with the given name
+int vm_is_sym(const lval_t* v, const char* name) {
+    return v->type == LVAL_SYM && strcmp(v->sym, name) == 0;
+}
+
+// true if slot of env still binds sym to the builtin fn
+//  NB: bindings are never removed and are replaced in place, so a slot
+//      resolved at compile time only needs to be checked, not searched
+int vm_slot_is(env_t* e, int slot, const char* sym, builtinv_t fn) {
+    if (slot < 0 || slot >= e->count) return 0;
+    const lval_t* op = e->vals[slot];
+    if (op->type != LVAL_BUILTIN || op->builtinv != fn) return 0;
+    if (strcmp(e->syms[slot]->sym, sym) != 0) return 0;
+    if (env_reads) env_read(sym);
+    return 1;
+}
+
+// compile lval (borrowed) into chunk, resolving callee slots in env
+//  NB: depth is the stack depth before the value of v is pushed
+void vm_compile_expr(vm_chunk_t* c, env_t* e, const lval_t* v, int depth) {
+    if (depth + 1 > c->depth) c->depth = depth + 1;
+
+    switch (v->type) {
+        case LVAL_NUM: case LVAL_ERR: case LVAL_QEXPR: case LVAL_BUILTIN:
+        case LVAL_VEC: case LVAL_STR: case LVAL_MAP: case LVAL_SEQ:
+            vm_emit(c, OP_CONST, 0, lval_copy(v), NULL);
+            return;
+        case LVAL_SYM:
+            vm_emit(c, OP_LOAD, 0, lval_copy(v), NULL);
+            return;
+        case LVAL_SEXPR:
+            break;
+        default:
+            assert(0 && "trying to compile lval of unknown type");
+    }
+
+    // 0 elements: evaluate to itself
+    if (v->count == 0) {
+        vm_emit(c, OP_CONST, 0, lval_copy(v), NULL);
+        return;
+    }
+
+    // 1 element: eliminate parentheses
+    if (v->count == 1) {
+        vm_compile_expr(c, e, v->cell[0], depth);
+        return;
+    }
+
+    // superinstructions for common shapes
+    //  NB: the generic sequence emitted below is 4 and 3 instructions long
+    if (v->count == 3 && vm_is_sym(v->cell[0], "+") &&
+        v->cell[1]->type == LVAL_SYM && v->cell[2]->type == LVAL_NUM) {
+        vm_emit(c, OP_ADD_SYM_NUM, 4,
+                lval_copy(v->cell[1]), lval_copy(v->cell[2]));
+        c->code[c->count - 1].slot = env_slot(e, "+");
+    } else if (v->count == 2 && vm_is_sym(v->cell[0], "head") &&
+               v->cell[1]->type == LVAL_SYM) {
+        vm_emit(c, OP_HEAD_SYM, 3, lval_copy(v->cell[1]), NULL);
+        c->code[c->count - 1].slot = env_slot(e, "head");
+    }
+
+    // generic call: push callee and arguments, then call
+    for (int j = 0; j < v->count; ++j)
+        vm_compile_expr(c, e, v->cell[j], depth + j);
+    vm_emit(c, OP_CALL, v->count - 1, NULL, NULL);
+}
+
+// compile lval (borrowed) into new chunk for env
+vm_chunk_t* vm_compile(env_t* e, const lval_t* v) {
+    vm_chunk_t* c = malloc(sizeof(vm_chunk_t));
+    c->code = NULL;
+    c->count = 0;
+    c->depth = 0;
+    c->threaded = 0;
+
+    vm_compile_expr(c, e, v, 0);
+    vm_emit(c, OP_RET, 0, NULL, NULL);
+
+    return c;
+}
+
+// free chunk
+void vm_chunk_del(vm_chunk_t* c) {
+    for (int j = 0; j < c->count; ++j) {
+        if (c->code[j].k)  lval_del(c->code[j].k);
+        if (c->code[j].k2) lval_del(c->code[j].k2);
+    }
+    free(c->code);
+    free(c);
+}
+
+/***********/
+/* runtime */
+/***********/
+
+// call callee with n arguments taken from the top of the stack
+//  NB: errors never make it onto the stack (see VM_PUSH)
+lval_t* vm_call(env_t* e, lval_t** base, int n) {
+    // borrowing builtins read their arguments from the stack
+    if (base[0]->type == LVAL_BUILTIN && base[0]->builtinv) {
+        lval_t* ret = base[0]->builtinv(e, n, base + 1);
+        for (int j = 0; j <= n; ++j)
+            lval_del(base[j]);
+        return ret;
+    }
+
+    // move arguments into s-expression
+    lval_t* args = lval_sexpr();
+    args->count = n;
+    args->cell = malloc(sizeof(lval_t*) * n);
+    memcpy(args->cell, base + 1, sizeof(lval_t*) * n);
+
+    return lval_call(e, base[0], args);
+}
+
+// run compiled chunk
+//  NB: may return a tail call (see lval_force)
+lval_t* vm_run(env_t* e, vm_chunk_t* c) {
+#ifdef VM_THREADED
+    static const void* labels[OP_COUNT] = {
+        [OP_CONST]       = &&L_OP_CONST,
+        [OP_LOAD]        = &&L_OP_LOAD,
+        [OP_CALL]        = &&L_OP_CALL,
+        [OP_RET]         = &&L_OP_RET,
+        [OP_ADD_SYM_NUM] = &&L_OP_ADD_SYM_NUM,
+        [OP_HEAD_SYM]    = &&L_OP_HEAD_SYM,
+    };
+
+    // resolve handlers once per chunk
+    if (!c->threaded) {
+        for (int j = 0; j < c->count; ++j)
+            c->code[j].handler = labels[c->code[j].op];
+        c->threaded = 1;
+    }
+
+    #define VM_TARGET(OP) L_##OP
+    #define VM_NEXT()     goto *ip->handler
+#else
+    #define VM_TARGET(OP) case OP
+    #define VM_NEXT()     goto dispatch
+#endif
+
+    // push value, aborting the whole evaluation on errors
+    //  NB: an error always ends up being the result of the form,
+    //      so the rest of the code does not need to run
+    #define VM_PUSH(VAL) do {                   \
+            *sp++ = (VAL);                      \
+            if (sp[-1]->type == LVAL_ERR)       \
+                goto fail;                      \
+        } while (0)
+
+    lval_t** stack = malloc(sizeof(lval_t*) * c->depth);
+    lval_t** sp = stack;
+    vm_insn_t* ip = c->code;
+    vm_insn_t* in;
+    lval_t* val;
+
+#ifdef VM_THREADED
+    VM_NEXT();
+    {
+#else
+dispatch:
+    switch (ip->op) {
+#endif
+    VM_TARGET(OP_CONST):
+        in = ip++;
+        VM_PUSH(lval_copy(in->k));
+        VM_NEXT();
+
+    VM_TARGET(OP_LOAD):
+        in = ip++;
+        VM_PUSH(env_find(e, in->k));
+        VM_NEXT();
+
+    VM_TARGET(OP_CALL):
+        in = ip++;
+        sp -= in->arg + 1;
+        val = vm_call(e, sp, in->arg);
+        // calls in tail position are forced by vm_eval
+        if (ip->op != OP_RET)
+            val = lval_force(e, val);
+        VM_PUSH(val);
+        VM_NEXT();
+
+    VM_TARGET(OP_ADD_SYM_NUM):
+        in = ip++;
+        {
+            long sum;
+            if (vm_slot_is(e, in->slot, "+", &builtin_add) &&
+                (val = env_get(e, in->k->sym)) && val->type == LVAL_NUM &&
+                !__builtin_add_overflow(val->num, in->k2->num, &sum)) {
+                *sp++ = lval_num(sum);
+                ip += in->arg;
+            }
+        }
+        VM_NEXT();
+
+    VM_TARGET(OP_HEAD_SYM):
+        in = ip++;
+        if (vm_slot_is(e, in->slot, "head", &builtin_head) &&
+            (val = env_get(e, in->k->sym)) &&
+            val->type == LVAL_QEXPR && val->count > 0) {
+            VM_PUSH(lval_copy(val->cell[0]));
+            ip += in->arg;
+        }
+        VM_NEXT();
+
+    VM_TARGET(OP_RET):
+        val = *--sp;
+        free(stack);
+        return val;
+
+#ifndef VM_THREADED
+    default:
+        assert(0 && "trying to run malformed bytecode");
+#endif
+    }
+
+    #undef VM_TARGET
+    #undef VM_NEXT
+    #undef VM_PUSH
+
+fail:
+    // release whole stack in one go and return error
+    val = *--sp;
+    while (sp != stack)
+        lval_del(*--sp);
+    free(stack);
+    return val;
+}
+
+// compile and run lval (consumed)
+//  NB: the bytecode of s-expressions is kept in their compiled form
+//      cache, so that copies of them (e.g. defs run again, see deps.h)
+//      are only compiled once. Bytecode looks operands up at run time,
+//      and callee slots cached by superinstructions are checked before
+//      use (see vm_slot_is), so it never goes stale
+lval_t* vm_eval(env_t* e, lval_t* v) {
+    if (v->type != LVAL_SEXPR) {
+        vm_chunk_t* c = vm_compile(e, v);
+        lval_del(v);
+        lval_t* ret = vm_run(e, c);
+        vm_chunk_del(c);
+        return lval_force(e, ret);
+    }
+
+    if (!v->code) v->code = lval_code_new();
+    if (!v->code->chunk) v->code->chunk = vm_compile(e, v);
+
+    // keep bytecode alive while running it
+    lval_code_t* code = v->code;
+    ++(code->refs);
+    lval_del(v);
+
+    lval_t* ret = vm_run(e, code->chunk);
+    lval_code_release(code);
+    return lval_force(e, ret);
+}
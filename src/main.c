@@ -1,6 +1,10 @@
+// GNU extensions (pinning actors to cores, see lval/actor.h)
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <limits.h>
 
 #include <editline/readline.h>
 #include <editline/history.h>
@@ -10,8 +14,115 @@
 #include "parsing.h"
 #include "lval/all.h"
 
+// evaluation engines
+typedef enum {
+    ENGINE_TREE,    // recursive tree walker
+    ENGINE_VM,      // bytecode virtual machine
+    ENGINE_MACHINE  // explicit continuation stack machine
+} engine_t;
+
+// repl options
+typedef struct {
+    engine_t engine;
+    int depth; // nesting limit of the stack machine (0 for default)
+    const char* const* scripts; // files to run instead of the repl
+    int count;
+    long fuel;    // maximum number of steps of each evaluation (0 for none)
+    long timeout; // maximum milliseconds of each evaluation (0 for none)
+    const char* image; // image to load before anything else (NULL if none)
+} repl_opts_t;
+
+// evaluate expression with selected engine, without a budget of its own
+//  NB: evaluations nested in a budgeted one are charged to it anyway
+lval_t* repl_run(const repl_opts_t* opts, env_t* env, lval_t* expr) {
+    switch (opts->engine) {
+        case ENGINE_VM:      return vm_eval(env, expr);
+        case ENGINE_MACHINE: return machine_eval(env, expr, opts->depth);
+        default:             return lval_eval(env, expr);
+    }
+}
+
+// evaluate expression with selected engine (see module_engine)
+lval_t* repl_run_opts(env_t* env, lval_t* expr, const void* opts) {
+    return repl_run(opts, env, expr);
+}
+
+// evaluate expression with selected engine
+//  NB: the expression is optimized first, with the current bindings
+lval_t* repl_eval(const repl_opts_t* opts, env_t* env, lval_t* expr) {
+    expr = lval_optimize(env, expr);
+
+    // budgeted evaluations run on the stack machine, as it can stop
+    // anywhere and drop everything it holds
+    if (opts->fuel > 0 || opts->timeout > 0) {
+        machine_t* m = machine_new(env, expr);
+        if (opts->depth > 0) m->limit = opts->depth;
+        if (opts->timeout > 0) machine_set_deadline(opts->timeout);
+
+        lval_t* ret = machine_fuel(m, opts->fuel > 0 ? opts->fuel : LONG_MAX);
+        if (!ret) ret = machine_starved();
+
+        if (opts->timeout > 0) machine_set_deadline(0);
+        machine_del(m);
+        return ret;
+    }
+    return repl_run(opts, env, expr);
+}
+
+// evaluate expression with selected engine (see deps_eval_t)
+lval_t* repl_eval_opts(env_t* env, lval_t* expr, const void* opts) {
+    return repl_eval(opts, env, expr);
+}
+
+// parse and evaluate line, printing its result
+//  NB: defs depending on what the line defines are run again
+//  NB: src holds the line (maybe among others), and is kept alive by
+//      the strings read from it
+void repl_line(const repl_opts_t* opts, alba_parser_t* parser, env_t* env,
+               const char* name, char* line, rope_buf_t* src) {
+    mpc_result_t r;
+    if (mpc_parse(name, line, parser->program, &r)) {
+        lval_t* expr = lval_read_src(r.output, src, line);
+        lval_t* result = deps_eval(env, expr, &repl_eval_opts, opts);
+        lval_println(result);
+        lval_del(result);
+        mpc_ast_delete(r.output);
+    } else {
+        mpc_err_print(r.error);
+        mpc_err_delete(r.error);
+    }
+}
+
+// run script files line by line, as if typed in the repl
+//  NB: all files are read before running the first one (see files.h)
+void repl_scripts(const repl_opts_t* opts, alba_parser_t* parser,
+                  env_t* env) {
+    files_buf_t* bufs = files_read_all(opts->scripts, opts->count);
+
+    for (int j = 0; j < opts->count; ++j) {
+        if (!bufs[j].data) {
+            fprintf(stderr, "cannot read %s: %s\n", opts->scripts[j],
+                    strerror(bufs[j].err));
+            continue;
+        }
+
+        // lines are cut in place, so the buffer is shared by all of them
+        rope_buf_t* src = rope_buf_adopt(bufs[j].data);
+        char* line = bufs[j].data;
+        while (line) {
+            char* end = strchr(line, '\n');
+            if (end) *end = '\0';
+            if (line[strspn(line, " \t\r")])
+                repl_line(opts, parser, env, opts->scripts[j], line, src);
+            line = end ? end + 1 : NULL;
+        }
+        rope_buf_release(src);
+    }
+    free(bufs);
+}
+
 // repl loop
-void repl() {
+void repl(const repl_opts_t* opts) {
     // create parser
     alba_parser_t* parser = alba_new_parser();
 
@@ -21,55 +132,181 @@ void repl() {
     // add builtins
     //  TODO: move this in separate file
     env_add(glbEnv, lval_sym("def"), lval_builtin(&builtin_def));
-    env_add(glbEnv, lval_sym("head"), lval_builtin(&builtin_head));
-    env_add(glbEnv, lval_sym("tail"), lval_builtin(&builtin_tail));
-    env_add(glbEnv, lval_sym("list"), lval_builtin(&builtin_list));
+    env_add(glbEnv, lval_sym("head"), lval_pure_builtinv(&builtin_head));
+    env_add(glbEnv, lval_sym("tail"), lval_pure_builtinv(&builtin_tail));
+    env_add(glbEnv, lval_sym("list"), lval_pure_builtin(&builtin_list));
     env_add(glbEnv, lval_sym("eval"), lval_builtin(&builtin_eval));
-    env_add(glbEnv, lval_sym("+"), lval_builtin(&builtin_add));
-    env_add(glbEnv, lval_sym("-"), lval_builtin(&builtin_subtract));
-    env_add(glbEnv, lval_sym("*"), lval_builtin(&builtin_multiply));
-    env_add(glbEnv, lval_sym("/"), lval_builtin(&builtin_divide));
-
-    // initialize REPL
-    puts("AlbaLisp v0.0.1");
-    puts("A toy language by Stefano Montesi");
-
-    puts("initializing REPL...");
-    puts("REPL ready, press Ctrl-C to terminate terminate it");
-
-    // REPL infinite loop
-    while (1) {
-        // repl prompt
-        char* input = readline("alba> ");
-        add_history(input);
-
-        // parse program and return "result"
-        mpc_result_t r;
-        if (mpc_parse("<stdin>", input, parser->program, &r)) {
-            lval_t* result = lval_eval(glbEnv, lval_read(r.output));
-            lval_println(result);
-            mpc_ast_delete(r.output);
-        } else {
-            mpc_err_print(r.error);
-            mpc_err_delete(r.error);
+    env_add(glbEnv, lval_sym("+"), lval_pure_builtinv(&builtin_add));
+    env_add(glbEnv, lval_sym("-"), lval_pure_builtinv(&builtin_subtract));
+    env_add(glbEnv, lval_sym("*"), lval_pure_builtinv(&builtin_multiply));
+    env_add(glbEnv, lval_sym("/"), lval_pure_builtinv(&builtin_divide));
+    env_add(glbEnv, lval_sym("vec"), lval_pure_builtinv(&builtin_vec));
+    env_add(glbEnv, lval_sym("len"), lval_pure_builtinv(&builtin_len));
+    env_add(glbEnv, lval_sym("sum"), lval_pure_builtinv(&builtin_sum));
+    env_add(glbEnv, lval_sym("dot"), lval_pure_builtinv(&builtin_dot));
+    env_add(glbEnv, lval_sym("min"), lval_pure_builtinv(&builtin_min));
+    env_add(glbEnv, lval_sym("max"), lval_pure_builtinv(&builtin_max));
+    env_add(glbEnv, lval_sym("scan"), lval_pure_builtinv(&builtin_scan));
+    env_add(glbEnv, lval_sym("filter-mask"),
+            lval_pure_builtinv(&builtin_filter_mask));
+    env_add(glbEnv, lval_sym("str-cat"), lval_pure_builtinv(&builtin_str_cat));
+    env_add(glbEnv, lval_sym("str-len"), lval_pure_builtinv(&builtin_str_len));
+    env_add(glbEnv, lval_sym("str-at"), lval_pure_builtinv(&builtin_str_at));
+    env_add(glbEnv, lval_sym("str-slice"),
+            lval_pure_builtinv(&builtin_str_slice));
+    env_add(glbEnv, lval_sym("from-list"),
+            lval_pure_builtinv(&builtin_from_list));
+    env_add(glbEnv, lval_sym("get"), lval_pure_builtinv(&builtin_get));
+    env_add(glbEnv, lval_sym("assoc"), lval_pure_builtin(&builtin_assoc));
+    env_add(glbEnv, lval_sym("dissoc"), lval_pure_builtin(&builtin_dissoc));
+    env_add(glbEnv, lval_sym("keys"), lval_pure_builtinv(&builtin_keys));
+    env_add(glbEnv, lval_sym("vals"), lval_pure_builtinv(&builtin_vals));
+    env_add(glbEnv, lval_sym("range"), lval_pure_builtinv(&builtin_range));
+    env_add(glbEnv, lval_sym("range-from"),
+            lval_pure_builtinv(&builtin_range_from));
+    env_add(glbEnv, lval_sym("map"), lval_pure_builtinv(&builtin_map));
+    env_add(glbEnv, lval_sym("filter"), lval_pure_builtinv(&builtin_filter));
+    env_add(glbEnv, lval_sym("take"), lval_pure_builtinv(&builtin_take));
+    env_add(glbEnv, lval_sym("reduce"), lval_builtinv(&builtin_reduce));
+    env_add(glbEnv, lval_sym("collect"), lval_builtinv(&builtin_collect));
+    env_add(glbEnv, lval_sym("read-file"), lval_builtinv(&builtin_read_file));
+    env_add(glbEnv, lval_sym("pmap"), lval_builtinv(&builtin_pmap));
+    env_add(glbEnv, lval_sym("preduce"), lval_builtinv(&builtin_preduce));
+    env_add(glbEnv, lval_sym("pfor"), lval_builtinv(&builtin_pfor));
+    env_add(glbEnv, lval_sym("async"), lval_builtinv(&builtin_async));
+    env_add(glbEnv, lval_sym("await"), lval_async_builtinv(&builtin_await));
+    env_add(glbEnv, lval_sym("io-read"),
+            lval_async_builtinv(&builtin_io_read));
+    env_add(glbEnv, lval_sym("io-write"),
+            lval_async_builtinv(&builtin_io_write));
+    env_add(glbEnv, lval_sym("io-open"), lval_builtinv(&builtin_io_open));
+    env_add(glbEnv, lval_sym("io-close"), lval_builtinv(&builtin_io_close));
+    env_add(glbEnv, lval_sym("io-pairs"), lval_builtinv(&builtin_io_pairs));
+    env_add(glbEnv, lval_sym("spawn"), lval_builtinv(&builtin_async));
+    env_add(glbEnv, lval_sym("join"), lval_async_builtinv(&builtin_await));
+    env_add(glbEnv, lval_sym("yield"), lval_async_builtinv(&builtin_yield));
+    env_add(glbEnv, lval_sym("chan"), lval_builtinv(&builtin_chan));
+    env_add(glbEnv, lval_sym("send"), lval_async_builtinv(&builtin_send));
+    env_add(glbEnv, lval_sym("recv"), lval_async_builtinv(&builtin_recv));
+    env_add(glbEnv, lval_sym("actor"), lval_builtinv(&builtin_actor));
+    env_add(glbEnv, lval_sym("tell"), lval_builtinv(&builtin_tell));
+    env_add(glbEnv, lval_sym("ask"), lval_builtinv(&builtin_ask));
+    env_add(glbEnv, lval_sym("with-fuel"), lval_builtinv(&builtin_with_fuel));
+    env_add(glbEnv, lval_sym("memo"), lval_builtinv(&builtin_memo));
+    env_add(glbEnv, lval_sym("memo-cap"), lval_builtinv(&builtin_memo_cap));
+    env_add(glbEnv, lval_sym("memo-stats"), lval_builtinv(&builtin_memo_stats));
+    env_add(glbEnv, lval_sym("while"), lval_builtinv(&builtin_while));
+    env_add(glbEnv, lval_sym("dotimes"), lval_builtinv(&builtin_dotimes));
+    env_add(glbEnv, lval_sym("fold"), lval_builtinv(&builtin_fold));
+    env_add(glbEnv, lval_sym("load"), lval_builtinv(&builtin_load));
+    env_add(glbEnv, lval_sym("save-image"),
+            lval_builtinv(&builtin_save_image));
+
+    // builtins bound so far name those saved in images
+    image_register(glbEnv);
+
+    // loaded files run on the selected engine
+    module_engine = &repl_run_opts;
+    module_engine_ctx = opts;
+
+    // restore bindings of image, if any
+    if (opts->image) {
+        lval_t* err = image_load(glbEnv, opts->image);
+        if (err) {
+            lval_println(err);
+            lval_del(err);
         }
+    }
+
+    // run scripts, if any
+    if (opts->count > 0) {
+        repl_scripts(opts, parser, glbEnv);
+    } else {
+        // initialize REPL
+        puts("AlbaLisp v0.0.1");
+        puts("A toy language by Stefano Montesi");
+
+        puts("initializing REPL...");
+        puts("REPL ready, press Ctrl-C to terminate terminate it");
 
-        // free input memory
-        free(input);
+        // REPL infinite loop
+        while (1) {
+            // repl prompt
+            char* input = readline("alba> ");
+            if (!input) break;
+            add_history(input);
+
+            // parse program and return "result"
+            //  NB: the line is kept alive by the strings read from it
+            rope_buf_t* src = rope_buf_adopt(input);
+            repl_line(opts, parser, glbEnv, "<stdin>", input, src);
+            rope_buf_release(src);
+        }
     }
 
+    // stop actors
+    actor_shutdown();
+    memo_shutdown();
+    deps_shutdown();
+
+    // drop pending tasks (which use the global environment)
+    green_shutdown();
+    io_shutdown();
+
     // clen up global environment
     env_del(glbEnv);
 
-    // clean up parser
+    // stop worker threads
+    pool_shutdown();
+    lval_freelist_drain();
+
+    // clean up parsers and registered builtins
+    module_shutdown();
+    image_shutdown();
     alba_free_parser(parser);
 }
 
 // MAIN
 int main(int argc, char** argv) {
-    repl();
+    // parse command line options
+    //  --vm          run on the bytecode virtual machine
+    //  --stack       run on the explicit continuation stack machine
+    //  --depth N     nesting limit of the stack machine
+    //  --par         evaluate expensive pure arguments in parallel
+    //  --par-cost N  minimum estimated cost of those arguments
+    //  --fuel N      stop evaluations after N steps (on the stack machine)
+    //  --timeout MS  stop evaluations after MS milliseconds (likewise)
+    //  --memo-cap N  maximum bytes of results kept by memo
+    //  --image FILE  load bindings saved by save-image on startup
+    //  FILE...       run script files instead of the repl
+    repl_opts_t opts = { ENGINE_TREE, 0, NULL, 0, 0, 0, NULL };
+    const char** scripts = malloc(sizeof(char*) * argc);
+    for (int j = 1; j < argc; ++j) {
+        if (strcmp(argv[j], "--vm") == 0)
+            opts.engine = ENGINE_VM;
+        else if (strcmp(argv[j], "--stack") == 0)
+            opts.engine = ENGINE_MACHINE;
+        else if (strcmp(argv[j], "--depth") == 0 && j + 1 < argc)
+            opts.depth = atoi(argv[++j]);
+        else if (strcmp(argv[j], "--par") == 0)
+            par_min_cost = PAR_DEFAULT_COST;
+        else if (strcmp(argv[j], "--par-cost") == 0 && j + 1 < argc)
+            par_min_cost = atol(argv[++j]);
+        else if (strcmp(argv[j], "--fuel") == 0 && j + 1 < argc)
+            opts.fuel = atol(argv[++j]);
+        else if (strcmp(argv[j], "--timeout") == 0 && j + 1 < argc)
+            opts.timeout = atol(argv[++j]);
+        else if (strcmp(argv[j], "--memo-cap") == 0 && j + 1 < argc)
+            memo_max_bytes = atol(argv[++j]);
+        else if (strcmp(argv[j], "--image") == 0 && j + 1 < argc)
+            opts.image = argv[++j];
+        else
+            scripts[opts.count++] = argv[j];
+    }
+    opts.scripts = scripts;
 
-    alba_new_parser
+    repl(&opts);
+    free(scripts);
 
     return 0;
 }
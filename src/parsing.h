@@ -6,9 +6,11 @@
 typedef struct {
     mpc_parser_t* number;
     mpc_parser_t* symbol;
+    mpc_parser_t* string;
     mpc_parser_t* expr;
     mpc_parser_t* sexpr;
     mpc_parser_t* qexpr;
+    mpc_parser_t* vector;
     mpc_parser_t* program;
 } alba_parser_t;
 
@@ -18,8 +20,10 @@ alba_parser_t* alba_new_parser() {
 
     parser->number  = mpc_new("number");
     parser->symbol  = mpc_new("symbol");
+    parser->string  = mpc_new("string");
     parser->sexpr   = mpc_new("sexpr");
     parser->qexpr   = mpc_new("qexpr");
+    parser->vector  = mpc_new("vector");
     parser->expr    = mpc_new("expr");
     parser->program = mpc_new("program");
 
@@ -27,13 +31,16 @@ alba_parser_t* alba_new_parser() {
         "                                                  \
         number  : /-?[0-9]+/;                              \
         symbol  : /[-+*\\/a-zA-Z_\\%]+/;                   \
+        string  : /\"(\\\\.|[^\"])*\"/;                   \
         sexpr   : '(' <expr>* ')';                         \
         qexpr   : '{' <expr>* '}';                         \
-        expr    : <number> | <symbol> | <sexpr> | <qexpr>; \
+        vector  : '[' <number>* ']';                       \
+        expr    : <number> | <symbol> | <string>           \
+                | <sexpr> | <qexpr> | <vector>;            \
         program : /^/ <expr>* /$/;                         \
         ",
-        parser->number, parser->symbol,
-        parser->sexpr, parser->qexpr,
+        parser->number, parser->symbol, parser->string,
+        parser->sexpr, parser->qexpr, parser->vector,
         parser->expr, parser->program);
 
     return parser;
@@ -41,7 +48,8 @@ alba_parser_t* alba_new_parser() {
 
 // free alba lisp parser
 void alba_free_parser(alba_parser_t* parser) {
-    mpc_cleanup(5, parser->number, parser->symbol,
-                   parser->sexpr, parser->expr,
-                   parser->program);
+    mpc_cleanup(8, parser->number, parser->symbol, parser->string,
+                   parser->sexpr, parser->qexpr, parser->vector,
+                   parser->expr, parser->program);
+    free(parser);
 }
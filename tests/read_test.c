@@ -0,0 +1,58 @@
+// checks that string literals read from scripts share the script's buffer
+//  NB: scripts are cut into lines in place, and every line is parsed on
+//      its own (see repl_scripts), so literals past the first line are
+//      only found in the buffer through the position of their line
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+
+#include "mpc.h"
+
+#include "parsing.h"
+#include "lval/all.h"
+
+// read line (cut in place from the buffer of src) like repl_scripts does,
+// and check that the literal of (def {name} "literal") points into it
+int check_line(alba_parser_t* parser, rope_buf_t* src, char* line) {
+    mpc_result_t r;
+    if (!mpc_parse("read_test", line, parser->program, &r)) {
+        mpc_err_print(r.error);
+        mpc_err_delete(r.error);
+        return 0;
+    }
+
+    lval_t* prog = lval_read_src(r.output, src, line);
+    mpc_ast_delete(r.output);
+    const lval_t* lit = prog->cell[0]->cell[2];
+    int shared = lit->type == LVAL_STR && !lit->str->left &&
+                 lit->str->buf == src &&
+                 lit->str->data > line && lit->str->data < line + strlen(line);
+    printf("%s %s\n", shared ? "ok  " : "FAIL", line);
+    lval_del(prog);
+    return shared;
+}
+
+int main(void) {
+    alba_parser_t* parser = alba_new_parser();
+    char* data = strdup("(def {a} \"first\")\n"
+                        "(def {b} \"second\")\n"
+                        "  (def {c} \"third\")\n");
+    rope_buf_t* src = rope_buf_adopt(data);
+
+    int ok = 1;
+    char* line = data;
+    while (line && *line) {
+        char* end = strchr(line, '\n');
+        if (end) *end = '\0';
+        ok &= check_line(parser, src, line);
+        line = end ? end + 1 : NULL;
+    }
+
+    rope_buf_release(src);
+    alba_free_parser(parser);
+    return ok ? 0 : 1;
+}
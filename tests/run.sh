@@ -0,0 +1,44 @@
+#!/bin/sh
+# run test scripts on every engine and compare their output
+#  usage: tests/run.sh BINARY [NAME...]
+#  NB: tests/NAME.alba is run as a script, with the options in
+#      tests/NAME.flags (if any), and has to print tests/NAME.out on
+#      the tree walker, the VM and the stack machine alike. Without
+#      names, every test is run. The script tests/NAME.pre (if any)
+#      is run before, on the same engine, with its output ignored
+#      (e.g. to save an image the test loads). Tests run in a scratch
+#      copy of the tests directory, so the files they load and write
+#      (caches, images) do not end up in the tree.
+if [ $# -lt 1 ]; then
+    echo "usage: $0 BINARY [NAME...]" >&2
+    exit 2
+fi
+
+bin=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+src=$(cd "$(dirname "$0")" && pwd)
+shift
+if [ $# -eq 0 ]; then
+    set -- $(cd "$src" && ls *.alba | sed 's/\.alba$//')
+fi
+
+failed=0
+for name in "$@"; do
+    flags=
+    [ -f "$src/$name.flags" ] && flags=$(cat "$src/$name.flags")
+    for engine in "" --vm --stack; do
+        tmp=$(mktemp -d)
+        cp -R "$src/." "$tmp"
+        if (cd "$tmp" &&
+            { [ ! -f "$name.pre" ] || "$bin" $engine "$name.pre" > /dev/null; } &&
+            "$bin" $engine $flags "$name.alba" > out 2>&1 &&
+            diff -u "$name.out" out > diff); then
+            echo "ok   $name $engine"
+        else
+            echo "FAIL $name $engine"
+            cat "$tmp/diff" 2>/dev/null || cat "$tmp/out"
+            failed=1
+        fi
+        rm -rf "$tmp"
+    done
+done
+exit $failed